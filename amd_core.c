@@ -0,0 +1,879 @@
+/*
+ * amd_core.c -- FreeSWITCH independent part of the detector
+ *
+ * See amd_core.h. Everything here runs on the caller's thread with the
+ * caller's state; the only globals are the read-only tables and the model.
+ */
+#include "amd_core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+const char *amd_sm_state_names[AMD_SM_STATES] = {
+	[AMD_SM_INITIAL_SILENCE] = "initial-silence",
+	[AMD_SM_INTRO_INTER_WORD] = "intro-inter-word",
+	[AMD_SM_INTRO_IN_WORD] = "intro-in-word",
+	[AMD_SM_INTER_WORD] = "inter-word",
+	[AMD_SM_IN_WORD] = "in-word"
+};
+
+/* silent-max-session keeps the mod_com_amd result name */
+const amd_verdict_info_t amd_verdicts[AMD_VERDICTS] = {
+	[AMD_VERDICT_NONE] = { "none", NULL, NULL },
+	[AMD_VERDICT_MAX_INTRO] = { "max-intro", "machine", "max-intro" },
+	[AMD_VERDICT_MAX_COUNT] = { "max-count", "machine", "max-count" },
+	[AMD_VERDICT_SILENT_INITIAL] = { "silent-initial", "person", "silent-initial" },
+	[AMD_VERDICT_SILENT_AFTER_INTRO] = { "silent-after-intro", "person", "silent-after-intro" },
+	[AMD_VERDICT_SILENT_MAX_SESSION] = { "silent-max-session", "person", "silent-after-intro" },
+	[AMD_VERDICT_TALK_BACK] = { "talk-back", "person", "talk-back" },
+	[AMD_VERDICT_TOO_LONG] = { "too-long", "unsure", "too-long" },
+	[AMD_VERDICT_MODEL_MACHINE] = { "model-machine", "machine", "model" },
+	[AMD_VERDICT_MODEL_PERSON] = { "model-person", "person", "model" },
+	[AMD_VERDICT_FINGERPRINT] = { "fingerprint", "machine", "fingerprint" }
+};
+
+amd_model_t amd_model;
+
+uint64_t amd_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Score an L16 PCM frame - assumes frame is already decoded to L16.
+ * When write_score is given and the frame is a read/write stereo frame, the
+ * score of the second (write) channel is computed in the same pass.
+ */
+uint32_t amd_frame_score(const amd_pcm_t *pcm, uint32_t *write_score)
+{
+	const int16_t *audio = pcm->data;
+	uint32_t count, j;
+	double energy, write_energy;
+	int divisor;
+	uint32_t channels;
+
+	/* Match original mod_amd exactly - simple and straightforward */
+	/* Reference: https://raw.githubusercontent.com/seanbright/mod_amd/master/mod_amd.c */
+	/* silent_threshold: The level of volume to consider talking or not talking */
+	/* score represents volume/energy - compare against threshold to classify */
+	divisor = pcm->rate > 0 ? pcm->rate / 8000 : 1;
+	channels = pcm->channels > 0 ? pcm->channels : 1;
+
+	if (write_score && channels > 1) {
+		for (energy = 0, write_energy = 0, j = 0, count = 0; count < pcm->samples; count++, j += channels) {
+			energy += abs(audio[j]);
+			write_energy += abs(audio[j + 1]);
+		}
+		*write_score = (uint32_t) (write_energy / (pcm->samples / divisor));
+	} else {
+		for (energy = 0, j = 0, count = 0; count < pcm->samples; count++) {
+			energy += abs(audio[j++]);
+			j += channels - 1;  /* Skip other channels to get next sample of same channel (for mono: no skip, for stereo: skip 1) */
+		}
+	}
+
+	return (uint32_t) (energy / (pcm->samples / divisor));
+}
+
+/* Energy engine: the original mod_amd average-amplitude classifier */
+static int energy_init(amd_vad_hot_t *hot, void *state)
+{
+	return 0;
+}
+
+static amd_frame_classifier energy_process_frame(amd_vad_hot_t *hot, void *state, const amd_pcm_t *pcm, amd_verdict_t *verdict)
+{
+	return amd_classify_frame(pcm, hot->silent_threshold, hot->dual ? &hot->write_score : NULL);
+}
+
+static void energy_finish(amd_vad_hot_t *hot, void *state)
+{
+}
+
+static size_t energy_footprint(void)
+{
+	return 0;
+}
+
+const amd_engine_t amd_energy_engine = {
+	"energy",
+	energy_init,
+	energy_process_frame,
+	energy_finish,
+	energy_footprint
+};
+
+/*
+ * GMM engine: fixed-point two-band Gaussian VAD in the spirit of the WebRTC VAD.
+ * The frame is split into a low band (x[n] + x[n-1]) and a high band
+ * (x[n] - x[n-1]); the log2 energy of each band (Q7) is scored against an
+ * adaptive noise Gaussian and an adaptive speech Gaussian. The summed
+ * log-likelihood ratio decides the frame, and the winning model is updated.
+ */
+#define AMD_GMM_BANDS 2
+#define AMD_GMM_Q 7
+#define AMD_GMM_ONE (1 << AMD_GMM_Q)
+#define AMD_GMM_FLOOR (10 * AMD_GMM_ONE)        /* log2 energy below this is always silence (~amplitude 32) */
+#define AMD_GMM_LLR_THRESHOLD (3 * AMD_GMM_ONE)
+#define AMD_GMM_MIN_GAP (2 * AMD_GMM_ONE)       /* Speech mean stays at least 6dB above noise */
+#define AMD_GMM_MIN_STD (AMD_GMM_ONE / 2)
+
+typedef struct {
+	int32_t noise_mean[AMD_GMM_BANDS];
+	int32_t noise_std[AMD_GMM_BANDS];
+	int32_t speech_mean[AMD_GMM_BANDS];
+	int32_t speech_std[AMD_GMM_BANDS];
+	int16_t last_sample;
+} amd_gmm_state_t;
+
+/* log2(v) in Q7, linear interpolation of the mantissa */
+int32_t amd_log2_q7(uint64_t v)
+{
+	int32_t msb;
+
+	if (v == 0) {
+		return 0;
+	}
+
+	msb = 63 - __builtin_clzll(v);
+	if (msb >= AMD_GMM_Q) {
+		return (msb << AMD_GMM_Q) + (int32_t) ((v >> (msb - AMD_GMM_Q)) & (AMD_GMM_ONE - 1));
+	}
+
+	return (msb << AMD_GMM_Q) + (int32_t) ((v << (AMD_GMM_Q - msb)) & (AMD_GMM_ONE - 1));
+}
+
+/* Squared distance of x from mean in units of std, Q7 */
+static int32_t gmm_distance_q7(int32_t x, int32_t mean, int32_t std)
+{
+	int64_t d = x - mean;
+
+	return (int32_t) (((d * d) << AMD_GMM_Q) / ((int64_t) std * std));
+}
+
+static int gmm_init(amd_vad_hot_t *hot, void *state)
+{
+	amd_gmm_state_t *gmm = (amd_gmm_state_t *) state;
+	int b;
+
+	for (b = 0; b < AMD_GMM_BANDS; b++) {
+		gmm->noise_mean[b] = 12 * AMD_GMM_ONE;   /* ~amplitude 64 */
+		gmm->noise_std[b] = 2 * AMD_GMM_ONE;
+		gmm->speech_mean[b] = 21 * AMD_GMM_ONE;  /* ~amplitude 1400 */
+		gmm->speech_std[b] = 3 * AMD_GMM_ONE;
+	}
+	gmm->last_sample = 0;
+
+	return 0;
+}
+
+static amd_frame_classifier gmm_process_frame(amd_vad_hot_t *hot, void *state, const amd_pcm_t *pcm, amd_verdict_t *verdict)
+{
+	amd_gmm_state_t *gmm = (amd_gmm_state_t *) state;
+	const int16_t *audio = pcm->data;
+	uint64_t band_energy[AMD_GMM_BANDS] = { 0 };
+	int32_t x[AMD_GMM_BANDS];
+	int32_t llr = 0, prev = gmm->last_sample;
+	uint32_t channels = pcm->channels, count, j;
+	amd_frame_classifier result;
+	int b;
+
+	for (j = 0, count = 0; count < pcm->samples; count++, j += channels) {
+		int32_t cur = audio[j];
+		int32_t low = (cur + prev) >> 1;
+		int32_t high = (cur - prev) >> 1;
+
+		band_energy[0] += (uint64_t) (low * low);
+		band_energy[1] += (uint64_t) (high * high);
+		prev = cur;
+	}
+	gmm->last_sample = (int16_t) prev;
+
+	for (b = 0; b < AMD_GMM_BANDS; b++) {
+		x[b] = amd_log2_q7(band_energy[b] / pcm->samples);
+		llr += (gmm_distance_q7(x[b], gmm->noise_mean[b], gmm->noise_std[b]) -
+				gmm_distance_q7(x[b], gmm->speech_mean[b], gmm->speech_std[b])) / 2;
+		llr += amd_log2_q7(gmm->noise_std[b]) - amd_log2_q7(gmm->speech_std[b]);
+	}
+
+	result = (llr > AMD_GMM_LLR_THRESHOLD && (x[0] > AMD_GMM_FLOOR || x[1] > AMD_GMM_FLOOR)) ? VOICED : SILENCE;
+
+	/* Adapt the model that won this frame */
+	for (b = 0; b < AMD_GMM_BANDS; b++) {
+		if (result == VOICED) {
+			gmm->speech_mean[b] += (x[b] - gmm->speech_mean[b]) >> 5;
+			gmm->speech_std[b] += (abs(x[b] - gmm->speech_mean[b]) - gmm->speech_std[b]) >> 5;
+		} else {
+			gmm->noise_mean[b] += (x[b] - gmm->noise_mean[b]) >> 4;
+			gmm->noise_std[b] += (abs(x[b] - gmm->noise_mean[b]) - gmm->noise_std[b]) >> 4;
+		}
+
+		if (gmm->noise_std[b] < AMD_GMM_MIN_STD) {
+			gmm->noise_std[b] = AMD_GMM_MIN_STD;
+		}
+		if (gmm->speech_std[b] < AMD_GMM_MIN_STD) {
+			gmm->speech_std[b] = AMD_GMM_MIN_STD;
+		}
+		if (gmm->speech_mean[b] < gmm->noise_mean[b] + AMD_GMM_MIN_GAP) {
+			gmm->speech_mean[b] = gmm->noise_mean[b] + AMD_GMM_MIN_GAP;
+		}
+	}
+
+	return result;
+}
+
+static void gmm_finish(amd_vad_hot_t *hot, void *state)
+{
+	amd_gmm_state_t *gmm = (amd_gmm_state_t *) state;
+
+	if (hot->debug) {
+		amd_core_log(hot->owner, AMD_LOG_DEBUG,
+			"AMD: GMM final model - noise low=%d high=%d, speech low=%d high=%d (log2 Q7)\n",
+			gmm->noise_mean[0], gmm->noise_mean[1], gmm->speech_mean[0], gmm->speech_mean[1]);
+	}
+}
+
+static size_t gmm_footprint(void)
+{
+	return sizeof(amd_gmm_state_t);
+}
+
+const amd_engine_t amd_gmm_engine = {
+	"gmm",
+	gmm_init,
+	gmm_process_frame,
+	gmm_finish,
+	gmm_footprint
+};
+
+/*
+ * Model file format, whitespace separated, '#' starts a comment:
+ *   window <frames>
+ *   bias <float>
+ *   machine_logit <float>
+ *   person_logit <float>
+ *   weights <window * 3 floats: energy, voiced, zero crossings per frame, oldest frame first>
+ */
+int amd_model_load(const char *path, amd_model_t *m)
+{
+	FILE *fp;
+	char line[1024];
+	uint32_t nweights = 0;
+	int in_weights = 0;
+
+	memset(m, 0, sizeof(*m));
+
+	if (!(fp = fopen(path, "r"))) {
+		amd_core_log(NULL, AMD_LOG_ERROR, "AMD: Cannot open model file %s\n", path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *tok, *save = NULL;
+		char *hash = strchr(line, '#');
+
+		if (hash) {
+			*hash = '\0';
+		}
+
+		for (tok = strtok_r(line, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save)) {
+			if (in_weights) {
+				double w = strtod(tok, NULL) * (1 << AMD_MODEL_WEIGHT_Q);
+
+				if (nweights >= AMD_MODEL_MAX_WINDOW * AMD_MODEL_FEATURES) {
+					nweights++;
+					continue;
+				}
+				if (w > INT16_MAX) {
+					w = INT16_MAX;
+				} else if (w < INT16_MIN) {
+					w = INT16_MIN;
+				}
+				m->weights[nweights++] = (int16_t) w;
+			} else if (!strcasecmp(tok, "weights")) {
+				in_weights = 1;
+			} else {
+				char *val = strtok_r(NULL, " \t\r\n", &save);
+
+				if (!val) {
+					break;
+				}
+				if (!strcasecmp(tok, "window")) {
+					m->window = atoi(val);
+				} else if (!strcasecmp(tok, "bias")) {
+					m->bias = (int64_t) (strtod(val, NULL) * (1 << AMD_MODEL_LOGIT_Q));
+				} else if (!strcasecmp(tok, "machine_logit")) {
+					m->machine_logit = (int64_t) (strtod(val, NULL) * (1 << AMD_MODEL_LOGIT_Q));
+				} else if (!strcasecmp(tok, "person_logit")) {
+					m->person_logit = (int64_t) (strtod(val, NULL) * (1 << AMD_MODEL_LOGIT_Q));
+				}
+			}
+		}
+	}
+	fclose(fp);
+
+	if (m->window == 0 || m->window > AMD_MODEL_MAX_WINDOW || nweights != m->window * AMD_MODEL_FEATURES) {
+		amd_core_log(NULL, AMD_LOG_ERROR,
+			"AMD: Invalid model file %s (window %u, %u weights, max window %d)\n",
+			path, m->window, nweights, AMD_MODEL_MAX_WINDOW);
+		memset(m, 0, sizeof(*m));
+		return -1;
+	}
+
+	m->loaded = 1;
+	amd_core_log(NULL, AMD_LOG_INFO, "AMD: Loaded model %s (window %u frames)\n", path, m->window);
+
+	return 0;
+}
+
+/*
+ * Model engine: energy classification for the word-count rules, plus
+ * fixed-point logistic regression over a sliding window of per-frame
+ * features (log2 energy, voiced flag, zero-crossing rate). Each feature row
+ * is stored twice in a ring of 2 * window rows, so the current window is
+ * always one contiguous slice and the dot product is a single straight
+ * loop the compiler can vectorize. The model verdict is "model"; the rules
+ * keep running and may conclude first.
+ */
+typedef struct {
+	int16_t features[2 * AMD_MODEL_MAX_WINDOW * AMD_MODEL_FEATURES];
+	uint32_t pos;
+	uint32_t frames;
+	uint64_t inference_ns;
+	uint64_t inference_max_ns;
+	uint64_t inferences;
+} amd_model_state_t;
+
+static int model_init(amd_vad_hot_t *hot, void *state)
+{
+	if (!amd_model.loaded) {
+		amd_core_log(hot->owner, AMD_LOG_ERROR, "AMD: Model engine selected but no model is loaded (check model_file)\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static amd_frame_classifier model_process_frame(amd_vad_hot_t *hot, void *state, const amd_pcm_t *pcm, amd_verdict_t *verdict)
+{
+	amd_model_state_t *st = (amd_model_state_t *) state;
+	amd_frame_classifier frame_type = amd_classify_frame(pcm, hot->silent_threshold, hot->dual ? &hot->write_score : NULL);
+	const uint32_t row = AMD_MODEL_FEATURES, window = amd_model.window;
+	const int16_t *audio = pcm->data;
+	const int16_t *x, *w = amd_model.weights;
+	uint64_t start = amd_now_ns(), elapsed, power = 0;
+	uint32_t channels = pcm->channels, count, j, crossings = 0;
+	int16_t feat[AMD_MODEL_FEATURES];
+	int32_t prev = 0;
+	int64_t logit = amd_model.bias;
+
+	for (j = 0, count = 0; count < pcm->samples; count++, j += channels) {
+		int32_t cur = audio[j];
+
+		power += (uint64_t) (cur * cur);
+		crossings += ((cur ^ prev) < 0);
+		prev = cur;
+	}
+
+	feat[0] = (int16_t) amd_log2_q7(power / pcm->samples);
+	feat[1] = frame_type == VOICED ? (1 << AMD_MODEL_FEATURE_Q) : 0;
+	feat[2] = (int16_t) ((crossings << AMD_MODEL_FEATURE_Q) / pcm->samples);
+
+	memcpy(&st->features[st->pos * row], feat, sizeof(feat));
+	memcpy(&st->features[(st->pos + window) * row], feat, sizeof(feat));
+	st->pos = (st->pos + 1) % window;
+	st->frames++;
+
+	if (st->frames < window) {
+		return frame_type;
+	}
+
+	/* Oldest frame of the window is at pos, newest at pos + window - 1 */
+	x = &st->features[st->pos * row];
+	for (j = 0; j < window * row; j++) {
+		logit += (int32_t) x[j] * w[j];
+	}
+
+	elapsed = amd_now_ns() - start;
+	st->inference_ns += elapsed;
+	st->inferences++;
+	if (elapsed > st->inference_max_ns) {
+		st->inference_max_ns = elapsed;
+	}
+
+	if (logit >= amd_model.machine_logit || logit <= amd_model.person_logit) {
+		if (hot->debug) {
+			amd_core_log(hot->owner, AMD_LOG_DEBUG,
+				"AMD: Model verdict - logit: %.3f, frames: %u\n",
+				(double) logit / (1 << AMD_MODEL_LOGIT_Q), st->frames);
+		}
+		*verdict = logit >= amd_model.machine_logit ? AMD_VERDICT_MODEL_MACHINE : AMD_VERDICT_MODEL_PERSON;
+	}
+
+	return frame_type;
+}
+
+static void model_finish(amd_vad_hot_t *hot, void *state)
+{
+}
+
+static size_t model_footprint(void)
+{
+	return sizeof(amd_model_state_t);
+}
+
+int amd_model_metrics(const void *state, uint64_t *avg_ns, uint64_t *max_ns)
+{
+	const amd_model_state_t *st = (const amd_model_state_t *) state;
+
+	if (!st || !st->inferences) {
+		return 0;
+	}
+
+	*avg_ns = st->inference_ns / st->inferences;
+	*max_ns = st->inference_max_ns;
+	return 1;
+}
+
+const amd_engine_t amd_model_engine = {
+	"model",
+	model_init,
+	model_process_frame,
+	model_finish,
+	model_footprint
+};
+
+const amd_engine_t *amd_engines[] = {
+	&amd_energy_engine,
+	&amd_gmm_engine,
+	&amd_model_engine,
+	NULL
+};
+
+const amd_engine_t *amd_find_engine(const char *name)
+{
+	int i;
+
+	if (!name || !strlen(name)) {
+		return NULL;
+	}
+
+	for (i = 0; amd_engines[i]; i++) {
+		if (!strcasecmp(amd_engines[i]->name, name)) {
+			return amd_engines[i];
+		}
+	}
+
+	return NULL;
+}
+
+void amd_params_parse(amd_params_t *p, const char *data, const void *owner)
+{
+	char *data_copy = NULL;
+	char *s, *key, *val, *next;
+
+	if (!data || !strlen(data)) {
+		return;
+	}
+
+	data_copy = strdup(data);
+	s = data_copy;
+
+	while (s && *s) {
+		/* Find the next comma or end of string */
+		next = strchr(s, ',');
+		if (next) {
+			*next++ = '\0';
+		}
+
+		/* Find the equals sign */
+		val = strchr(s, '=');
+		if (val) {
+			*val++ = '\0';
+			key = s;
+
+			/* Trim whitespace from key */
+			while (*key == ' ' || *key == '\t' || *key == '\n' || *key == '\r') key++;
+			{
+				char *end = key + strlen(key) - 1;
+				while (end > key && (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r')) *end-- = '\0';
+			}
+
+			/* Trim whitespace from val */
+			while (*val == ' ' || *val == '\t' || *val == '\n' || *val == '\r') val++;
+			{
+				char *end = val + strlen(val) - 1;
+				while (end > val && (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r')) *end-- = '\0';
+			}
+
+			if (!strcasecmp(key, "silent_threshold")) {
+				p->silent_threshold = atoi(val);
+			} else if (!strcasecmp(key, "silent_initial")) {
+				p->silent_initial = atoi(val);
+			} else if (!strcasecmp(key, "silent_after_intro")) {
+				p->silent_after_intro = atoi(val);
+			} else if (!strcasecmp(key, "silent_max_session")) {
+				p->silent_max_session = atoi(val);
+			} else if (!strcasecmp(key, "noise_max_intro")) {
+				p->noise_max_intro = atoi(val);
+			} else if (!strcasecmp(key, "noise_min_length")) {
+				p->noise_min_length = atoi(val);
+			} else if (!strcasecmp(key, "noise_inter_silence")) {
+				p->noise_inter_silence = atoi(val);
+			} else if (!strcasecmp(key, "noise_max_count")) {
+				p->noise_max_count = atoi(val);
+			} else if (!strcasecmp(key, "total_analysis_time")) {
+				p->total_analysis_time = atoi(val);
+			} else if (!strcasecmp(key, "debug")) {
+				p->debug = atoi(val);
+			} else if (!strcasecmp(key, "dual")) {
+				p->dual = atoi(val);
+			} else if (!strcasecmp(key, "response_window")) {
+				p->response_window = atoi(val);
+			} else if (!strcasecmp(key, "prompt_min_length")) {
+				p->prompt_min_length = atoi(val);
+			} else if (!strcasecmp(key, "engine")) {
+				p->engine = amd_find_engine(val);
+				if (!p->engine) {
+					amd_core_log(owner, AMD_LOG_WARNING, "AMD: Unknown engine '%s', using default\n", val);
+				}
+			}
+		}
+
+		s = next;
+	}
+
+	free(data_copy);
+}
+
+void amd_resolve_params(amd_vad_hot_t *hot, const amd_params_t *p, const amd_params_t *defaults)
+{
+	hot->silent_threshold = p->silent_threshold ? p->silent_threshold : defaults->silent_threshold;
+	hot->silent_initial = p->silent_initial ? p->silent_initial : defaults->silent_initial;
+	hot->silent_after_intro = p->silent_after_intro ? p->silent_after_intro : defaults->silent_after_intro;
+	hot->silent_max_session = p->silent_max_session ? p->silent_max_session : defaults->silent_max_session;
+	hot->noise_max_intro = p->noise_max_intro ? p->noise_max_intro : defaults->noise_max_intro;
+	hot->noise_min_length = p->noise_min_length ? p->noise_min_length : defaults->noise_min_length;
+	hot->noise_inter_silence = p->noise_inter_silence ? p->noise_inter_silence : defaults->noise_inter_silence;
+	hot->noise_max_count = p->noise_max_count ? p->noise_max_count : defaults->noise_max_count;
+	hot->total_analysis_time = p->total_analysis_time ? p->total_analysis_time : defaults->total_analysis_time;
+	hot->debug = p->debug ? p->debug : defaults->debug;
+	hot->dual = (p->dual ? p->dual : defaults->dual) ? 1 : 0;
+	hot->response_window = p->response_window ? p->response_window : defaults->response_window;
+	hot->prompt_min_length = p->prompt_min_length ? p->prompt_min_length : defaults->prompt_min_length;
+}
+
+amd_verdict_t amd_advance(amd_vad_hot_t *hot, const amd_pcm_t *pcm)
+{
+	if (pcm->rate > 0 && pcm->samples > 0) {
+		hot->frame_ms = 1000 / (pcm->rate / pcm->samples);
+	} else {
+		hot->frame_ms = 20; /* Default 20ms */
+	}
+	hot->total_duration += hot->frame_ms;
+
+	if (hot->total_duration >= hot->total_analysis_time) {
+		return AMD_VERDICT_TOO_LONG;
+	}
+
+	return AMD_VERDICT_NONE;
+}
+
+int amd_fp_key_usable(uint64_t key)
+{
+	uint32_t changes = 0, i;
+
+	if (!(key & (1ULL << 63))) {
+		return 0;
+	}
+
+	for (i = 1; i < AMD_FP_FRAMES; i++) {
+		if (((key >> (3 * i)) & 7) != ((key >> (3 * (i - 1))) & 7)) {
+			changes++;
+		}
+	}
+
+	return changes >= AMD_FP_MIN_CHANGES;
+}
+
+int amd_fp_update(amd_vad_hot_t *hot, const amd_pcm_t *pcm, amd_frame_classifier frame_type)
+{
+	uint32_t count, j;
+	uint64_t power = 0;
+	int32_t level, d, q;
+
+	if (hot->fp_done || (pcm && !pcm->samples)) {
+		return 0;
+	}
+
+	/* Wait for the greeting to start, on a frame with audio */
+	if (!hot->fp_frames && (frame_type != VOICED || !pcm)) {
+		return 0;
+	}
+
+	if (!pcm) {
+		/* Skipped frame: hold the previous level, so the key keeps its timing */
+		q = hot->fp_frames > 1 ? (int32_t) (hot->fp_key & 7) : 4;
+		hot->fp_frames++;
+	} else {
+		for (j = 0, count = 0; count < pcm->samples; count++, j += pcm->channels) {
+			power += (uint64_t) (pcm->data[j] * pcm->data[j]);
+		}
+		level = amd_log2_q7(power / pcm->samples);
+
+		if (!hot->fp_frames++) {
+			hot->fp_base = level;
+			return 0;
+		}
+
+		/* Bins of equal width, the base level in the middle of bin 4 */
+		d = level - hot->fp_base + AMD_FP_STEP / 2;
+		q = (d >= 0 ? d / AMD_FP_STEP : -((-d + AMD_FP_STEP - 1) / AMD_FP_STEP)) + 4;
+		q = q < 0 ? 0 : (q > 7 ? 7 : q);
+	}
+	hot->fp_key = (hot->fp_key << 3) | (uint64_t) q;
+
+	if (hot->fp_frames <= AMD_FP_FRAMES) {
+		return 0;
+	}
+
+	/* Top bit keeps a complete key distinct from an empty slot */
+	hot->fp_key |= 1ULL << 63;
+	hot->fp_done = 1;
+
+	if (!amd_fp_key_usable(hot->fp_key)) {
+		hot->fp_key = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * In dual mode the energy and model engines score our side in the same pass
+ * over the frame; other engines get a separate energy pass for it.
+ */
+amd_frame_classifier amd_engine_frame(amd_vad_hot_t *hot, const amd_engine_t *engine, void *state,
+									  const amd_pcm_t *pcm, amd_verdict_t *verdict)
+{
+	amd_frame_classifier frame_type;
+
+	*verdict = AMD_VERDICT_NONE;
+
+	if (!hot->dual) {
+		return engine->process_frame(hot, state, pcm, verdict);
+	}
+
+	hot->write_score = UINT32_MAX;
+	frame_type = engine->process_frame(hot, state, pcm, verdict);
+
+	if (hot->write_score == UINT32_MAX) {
+		amd_frame_score(pcm, &hot->write_score);
+	}
+
+	return frame_type;
+}
+
+/*
+ * Decision state machine
+ *
+ * Each frame looks up the row for (state, frame type) and applies the
+ * actions it lists, in bit order; only the threshold comparisons a state
+ * can actually need are made. Transitions go through the sm_* state maps.
+ *
+ * This is not faster than the branch tree it replaced: amd_test bench
+ * times both (state-machine and reference-tree rows, about 15 ns/frame
+ * each at -O2, the table a few percent slower), the row lookup and mask
+ * tests costing a little more than the well-predicted flag checks did. It is kept because five states replace
+ * five interacting flags, every rule a state can fire is visible in one
+ * table row, and a few ns is noise next to scoring the frame. amd_test
+ * check keeps the old tree as a reference and compares the two.
+ */
+enum {
+	SM_VOICE = 1 << 0,  /* Accumulate voice, reset silence */
+	SM_SILENCE = 1 << 1,  /* Accumulate silence */
+	SM_ENTER_INTRO = 1 << 2,  /* First voice after the initial silence starts the intro */
+	SM_INTRO_VOICE = 1 << 3,  /* Track continuous voice inside the intro */
+	SM_INTRO_END = 1 << 4,  /* total_duration >= noise_max_intro leaves the intro */
+	SM_INTRO_BREAK = 1 << 5,  /* silence >= noise_inter_silence breaks intro voice */
+	SM_WORD_START = 1 << 6,  /* voice >= noise_min_length counts a word */
+	SM_WORD_END = 1 << 7,  /* silence >= noise_inter_silence ends the word */
+	SM_MAX_INTRO = 1 << 8,
+	SM_MAX_COUNT = 1 << 9,
+	SM_SILENT_INITIAL = 1 << 10,
+	SM_SILENT_AFTER_INTRO = 1 << 11,
+	SM_SILENT_MAX_SESSION = 1 << 12
+};
+
+#define SM_INTRO_VOICED (SM_VOICE | SM_INTRO_VOICE | SM_INTRO_END | SM_MAX_INTRO)
+#define SM_INTRO_SILENCE (SM_SILENCE | SM_INTRO_END | SM_INTRO_BREAK | SM_WORD_END | SM_SILENT_AFTER_INTRO | SM_SILENT_MAX_SESSION)
+#define SM_AFTER_SILENCE (SM_SILENCE | SM_WORD_END | SM_SILENT_AFTER_INTRO | SM_SILENT_MAX_SESSION)
+
+/* Indexed by [state][frame type] (SILENCE, VOICED) */
+static const uint16_t sm_table[AMD_SM_STATES][2] = {
+	[AMD_SM_INITIAL_SILENCE] = {
+		SM_SILENCE | SM_SILENT_INITIAL,
+		SM_VOICE | SM_ENTER_INTRO | SM_INTRO_END | SM_WORD_START | SM_MAX_INTRO | SM_MAX_COUNT
+	},
+	[AMD_SM_INTRO_INTER_WORD] = { SM_INTRO_SILENCE, SM_INTRO_VOICED | SM_WORD_START | SM_MAX_COUNT },
+	[AMD_SM_INTRO_IN_WORD] = { SM_INTRO_SILENCE, SM_INTRO_VOICED },
+	[AMD_SM_INTER_WORD] = { SM_AFTER_SILENCE, SM_VOICE | SM_WORD_START | SM_MAX_COUNT },
+	[AMD_SM_IN_WORD] = { SM_AFTER_SILENCE, SM_VOICE }
+};
+
+/* State after the intro window closes */
+static const uint8_t sm_intro_end[AMD_SM_STATES] = {
+	[AMD_SM_INITIAL_SILENCE] = AMD_SM_INITIAL_SILENCE,
+	[AMD_SM_INTRO_INTER_WORD] = AMD_SM_INTER_WORD,
+	[AMD_SM_INTRO_IN_WORD] = AMD_SM_IN_WORD,
+	[AMD_SM_INTER_WORD] = AMD_SM_INTER_WORD,
+	[AMD_SM_IN_WORD] = AMD_SM_IN_WORD
+};
+
+/* State after a word is counted */
+static const uint8_t sm_word_start[AMD_SM_STATES] = {
+	[AMD_SM_INITIAL_SILENCE] = AMD_SM_INITIAL_SILENCE,
+	[AMD_SM_INTRO_INTER_WORD] = AMD_SM_INTRO_IN_WORD,
+	[AMD_SM_INTRO_IN_WORD] = AMD_SM_INTRO_IN_WORD,
+	[AMD_SM_INTER_WORD] = AMD_SM_IN_WORD,
+	[AMD_SM_IN_WORD] = AMD_SM_IN_WORD
+};
+
+/* State after a word break */
+static const uint8_t sm_word_end[AMD_SM_STATES] = {
+	[AMD_SM_INITIAL_SILENCE] = AMD_SM_INITIAL_SILENCE,
+	[AMD_SM_INTRO_INTER_WORD] = AMD_SM_INTRO_INTER_WORD,
+	[AMD_SM_INTRO_IN_WORD] = AMD_SM_INTRO_INTER_WORD,
+	[AMD_SM_INTER_WORD] = AMD_SM_INTER_WORD,
+	[AMD_SM_IN_WORD] = AMD_SM_INTER_WORD
+};
+
+/* Advance the state machine by one classified frame of hot->frame_ms */
+amd_verdict_t amd_sm_step(amd_vad_hot_t *hot, amd_frame_classifier frame_type)
+{
+	uint32_t actions = sm_table[hot->state][frame_type == VOICED];
+
+	if (actions & SM_VOICE) {
+		hot->voice_duration += hot->frame_ms;
+		hot->current_word_duration += hot->frame_ms;
+		hot->silence_duration = 0;
+		hot->last_noise_end = hot->total_duration;
+	}
+
+	if (actions & SM_SILENCE) {
+		hot->silence_duration += hot->frame_ms;
+		hot->voice_duration = 0;
+	}
+
+	if (actions & SM_ENTER_INTRO) {
+		hot->state = AMD_SM_INTRO_INTER_WORD;
+		hot->intro_voice_duration = hot->frame_ms;
+		hot->had_silence_break = 0;
+	}
+
+	if (actions & SM_INTRO_VOICE) {
+		/* A voice segment after a silence break restarts intro voice tracking */
+		if (hot->had_silence_break) {
+			hot->intro_voice_duration = hot->frame_ms;
+			hot->had_silence_break = 0;
+		} else {
+			hot->intro_voice_duration += hot->frame_ms;
+		}
+	}
+
+	if ((actions & SM_INTRO_END) && hot->total_duration >= hot->noise_max_intro) {
+		hot->state = sm_intro_end[hot->state];
+		actions &= ~(SM_INTRO_BREAK | SM_MAX_INTRO);
+	}
+
+	if ((actions & SM_INTRO_BREAK) && hot->silence_duration >= hot->noise_inter_silence) {
+		hot->had_silence_break = 1;
+		hot->intro_voice_duration = 0;
+	}
+
+	if ((actions & SM_WORD_START) && hot->current_word_duration >= hot->noise_min_length) {
+		hot->words++;
+		if (hot->total_duration < hot->noise_max_intro) {
+			hot->intro_words++;
+		}
+		hot->state = sm_word_start[hot->state];
+		hot->last_noise_start = hot->total_duration;
+	}
+
+	if ((actions & SM_WORD_END) && hot->silence_duration >= hot->noise_inter_silence) {
+		hot->state = sm_word_end[hot->state];
+		hot->current_word_duration = 0;
+	}
+
+	/* First word longer than noise_max_intro while still inside the intro */
+	if ((actions & SM_MAX_INTRO) && hot->words == 1 && hot->current_word_duration >= hot->noise_max_intro) {
+		return AMD_VERDICT_MAX_INTRO;
+	}
+
+	if ((actions & SM_MAX_COUNT) && hot->words >= hot->noise_max_count) {
+		return AMD_VERDICT_MAX_COUNT;
+	}
+
+	if ((actions & SM_SILENT_INITIAL) && hot->silence_duration >= hot->silent_initial) {
+		return AMD_VERDICT_SILENT_INITIAL;
+	}
+
+	if ((actions & SM_SILENT_AFTER_INTRO) && hot->words == 1 && hot->silence_duration >= hot->silent_after_intro) {
+		return AMD_VERDICT_SILENT_AFTER_INTRO;
+	}
+
+	if ((actions & SM_SILENT_MAX_SESSION) && hot->words > 0 && hot->silence_duration >= hot->silent_max_session) {
+		return AMD_VERDICT_SILENT_MAX_SESSION;
+	}
+
+	return AMD_VERDICT_NONE;
+}
+
+/*
+ * Dual-direction step: a callee who starts talking within response_window
+ * ms after our side played at least prompt_min_length ms of voice, and who
+ * kept mostly quiet while it played, is answering us. A recorded greeting
+ * talks over our prompt instead, which shows up as double talk.
+ */
+amd_verdict_t amd_dual_step(amd_vad_hot_t *hot, amd_frame_classifier frame_type)
+{
+	if (hot->write_score >= hot->silent_threshold) {
+		hot->prompt_duration += hot->frame_ms;
+		hot->prompt_gap = 0;
+		hot->response_duration = 0;
+		if (frame_type == VOICED) {
+			hot->double_talk_duration += hot->frame_ms;
+		}
+		return AMD_VERDICT_NONE;
+	}
+
+	if (hot->prompt_duration < hot->prompt_min_length) {
+		return AMD_VERDICT_NONE;
+	}
+
+	hot->prompt_gap += hot->frame_ms;
+
+	if (frame_type != VOICED) {
+		hot->response_duration = 0;
+		return AMD_VERDICT_NONE;
+	}
+
+	if (!hot->response_duration) {
+		hot->response_onset = hot->prompt_gap;
+	}
+	hot->response_duration += hot->frame_ms;
+
+	if (hot->response_onset <= hot->response_window &&
+		hot->response_duration >= hot->noise_min_length &&
+		hot->double_talk_duration * 2 < hot->prompt_duration) {
+		return AMD_VERDICT_TALK_BACK;
+	}
+
+	return AMD_VERDICT_NONE;
+}
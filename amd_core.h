@@ -0,0 +1,304 @@
+/*
+ * amd_core.h -- FreeSWITCH independent part of the detector
+ *
+ * Frame scoring, detection engines and the decision state machine, shared by
+ * mod_free_amd and the offline tools in tools/. Nothing here allocates,
+ * locks or talks to FreeSWITCH; the host owns the hot block and engine state
+ * and drives them frame by frame.
+ */
+#ifndef AMD_CORE_H
+#define AMD_CORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+	SILENCE,
+	VOICED
+} amd_frame_classifier;
+
+/* Decision state machine states, see sm_table */
+typedef enum {
+	AMD_SM_INITIAL_SILENCE,  /* No voice since answer */
+	AMD_SM_INTRO_INTER_WORD,  /* Within noise_max_intro, between words */
+	AMD_SM_INTRO_IN_WORD,  /* Within noise_max_intro, word counted */
+	AMD_SM_INTER_WORD,  /* After the intro, between words */
+	AMD_SM_IN_WORD,  /* After the intro, word counted */
+	AMD_SM_STATES
+} amd_vad_state_t;
+
+/* State names reported by amd_list / amd_status */
+extern const char *amd_sm_state_names[AMD_SM_STATES];
+
+/* Inside the intro window: voice seen, noise_max_intro not reached yet */
+static inline int amd_sm_in_intro(amd_vad_state_t state)
+{
+	return state == AMD_SM_INTRO_INTER_WORD || state == AMD_SM_INTRO_IN_WORD;
+}
+
+typedef enum {
+	AMD_VERDICT_NONE,
+	AMD_VERDICT_MAX_INTRO,
+	AMD_VERDICT_MAX_COUNT,
+	AMD_VERDICT_SILENT_INITIAL,
+	AMD_VERDICT_SILENT_AFTER_INTRO,
+	AMD_VERDICT_SILENT_MAX_SESSION,
+	AMD_VERDICT_TALK_BACK,
+	AMD_VERDICT_TOO_LONG,
+	AMD_VERDICT_MODEL_MACHINE,
+	AMD_VERDICT_MODEL_PERSON,
+	AMD_VERDICT_FINGERPRINT,
+	AMD_VERDICTS
+} amd_verdict_t;
+
+/* Published status/result per verdict */
+typedef struct {
+	const char *name;
+	const char *status;
+	const char *result;
+} amd_verdict_info_t;
+
+extern const amd_verdict_info_t amd_verdicts[AMD_VERDICTS];
+
+typedef enum {
+	AMD_LOG_ERROR,
+	AMD_LOG_WARNING,
+	AMD_LOG_INFO,
+	AMD_LOG_DEBUG
+} amd_log_level_t;
+
+/*
+ * Provided by the host. owner is the hot block's owner (NULL for messages
+ * not tied to a detection).
+ */
+void amd_core_log(const void *owner, amd_log_level_t level, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+/* One frame of decoded L16 audio; channel 0 is the callee, channel 1 (dual) our side */
+typedef struct {
+	const int16_t *data;
+	uint32_t samples;  /* Per channel */
+	uint32_t channels;
+	uint32_t rate;
+} amd_pcm_t;
+
+struct amd_engine_s;
+
+/* Per-session configuration as given to voice_start (0 means use the default) */
+typedef struct {
+	uint32_t silent_threshold;
+	uint32_t silent_initial;
+	uint32_t silent_after_intro;
+	uint32_t silent_max_session;
+	uint32_t noise_max_intro;
+	uint32_t noise_min_length;
+	uint32_t noise_inter_silence;
+	uint32_t noise_max_count;
+	uint32_t total_analysis_time;
+	uint32_t debug;
+	uint32_t dual;
+	uint32_t response_window;
+	uint32_t prompt_min_length;
+	const struct amd_engine_s *engine;
+} amd_params_t;
+
+/*
+ * Frame-hot detection state: everything the host reads or writes on a
+ * READ frame. The counters, flags and load accounting written on every
+ * frame fill the first cache line; the thresholds resolved at voice_start
+ * (read-only afterwards) and the fingerprint share the second; the
+ * dual-direction state and owner sit in a third line that mono detections
+ * never touch. The asserts below keep it that way. Blocks come from the
+ * module's hot slab, not the session pool, so they stay away from codec and
+ * session data and their total footprint can be reported.
+ *
+ * The media thread is the only writer. It bumps seq to an odd value before a
+ * READ frame and back to even after, so amd_list and amd_status can copy the
+ * block without a lock and retry on a torn read; owner tells them whether
+ * the block still belongs to the session they looked up.
+ */
+typedef struct amd_vad_hot_s {
+	uint32_t frame_ms;
+	uint32_t total_duration;
+	uint32_t silence_duration;
+	uint32_t voice_duration;
+	uint32_t current_word_duration;
+	uint32_t intro_voice_duration;
+	uint32_t words;  /* Total word count (throughout entire detection, including intro) */
+	uint32_t intro_words;  /* Word count during intro period (first noise_max_intro ms) */
+	uint32_t last_noise_start;
+	uint32_t last_noise_end;
+	amd_vad_state_t state;
+	uint32_t seq;  /* Odd while a READ frame is being processed */
+
+	uint32_t complete:1;
+	uint32_t talking:1;
+	uint32_t had_silence_break:1;  /* Track if we had a silence break during intro */
+	uint32_t fp_done:1;  /* Fingerprint complete (or abandoned) for this call */
+	uint32_t dual:1;  /* Stereo bug: read (callee) and write (our side) */
+
+	/* Load accounting, folded into the module counters on close */
+	uint32_t frames;
+	uint32_t skipped_frames;
+	amd_frame_classifier last_frame_type;  /* Reused for frames skipped in degraded mode */
+
+	/* Thresholds resolved at voice_start: per-session value, else amd.conf.xml */
+	uint32_t silent_threshold;
+	uint32_t silent_initial;
+	uint32_t silent_after_intro;
+	uint32_t silent_max_session;
+	uint32_t noise_max_intro;
+	uint32_t noise_min_length;
+	uint32_t noise_inter_silence;
+	uint32_t noise_max_count;
+	uint32_t total_analysis_time;
+	uint32_t debug;
+
+	/* Greeting fingerprint, built from the frames after the first voiced one */
+	uint64_t fp_key;
+	int32_t fp_base;
+	uint32_t fp_frames;
+
+	/* Dual-direction state, only touched with dual=1 */
+	uint32_t write_score __attribute__((aligned(64)));  /* Energy score of our side for the current frame */
+	uint32_t prompt_duration;  /* Voiced ms played by our side */
+	uint32_t prompt_gap;  /* ms since our side last played voice */
+	uint32_t response_duration;  /* Continuous callee voice after our prompt */
+	uint32_t response_onset;  /* prompt_gap when that voice started */
+	uint32_t double_talk_duration;  /* Callee voice while our side was playing */
+	uint32_t response_window;
+	uint32_t prompt_min_length;
+
+	const void *owner;  /* Host context using the block, NULL once freed */
+} __attribute__((aligned(64))) amd_vad_hot_t;
+
+_Static_assert(offsetof(amd_vad_hot_t, last_frame_type) + sizeof(amd_frame_classifier) <= 64,
+			   "per-frame counters must fit the first cache line");
+_Static_assert(offsetof(amd_vad_hot_t, silent_threshold) == 64, "thresholds must start the second cache line");
+_Static_assert(offsetof(amd_vad_hot_t, fp_frames) + sizeof(uint32_t) <= 128,
+			   "thresholds and fingerprint must fit the second cache line");
+_Static_assert(offsetof(amd_vad_hot_t, write_score) == 128, "dual state must start the third cache line");
+_Static_assert(sizeof(amd_vad_hot_t) == 192, "hot block must be three cache lines");
+
+/*
+ * Detection engines
+ *
+ * An engine turns each decoded L16 frame into a SILENCE/VOICED decision that
+ * drives the word-count state machine. Engines may also reach a verdict on
+ * their own by setting *verdict. Per-session engine state is allocated by
+ * the host, footprint() bytes in size and zeroed before init().
+ */
+typedef struct amd_engine_s {
+	const char *name;
+	int (*init)(amd_vad_hot_t *hot, void *state);  /* 0 on success */
+	amd_frame_classifier (*process_frame)(amd_vad_hot_t *hot, void *state, const amd_pcm_t *pcm, amd_verdict_t *verdict);
+	void (*finish)(amd_vad_hot_t *hot, void *state);
+	size_t (*footprint)(void);
+} amd_engine_t;
+
+extern const amd_engine_t amd_energy_engine;
+extern const amd_engine_t amd_gmm_engine;
+extern const amd_engine_t amd_model_engine;
+extern const amd_engine_t *amd_engines[];  /* NULL terminated */
+
+const amd_engine_t *amd_find_engine(const char *name);
+
+/*
+ * Logistic regression model used by the "model" engine.
+ * Each frame contributes AMD_MODEL_FEATURES fixed-point features (Q7); the
+ * last `window` frames are weighted and summed into a logit. Sizes are
+ * bounded at compile time so the per-frame cost has a fixed worst case.
+ */
+#define AMD_MODEL_FEATURES 3
+#define AMD_MODEL_MAX_WINDOW 64
+#define AMD_MODEL_FEATURE_Q 7
+#define AMD_MODEL_WEIGHT_Q 12
+#define AMD_MODEL_LOGIT_Q (AMD_MODEL_FEATURE_Q + AMD_MODEL_WEIGHT_Q)
+
+typedef struct {
+	uint32_t loaded:1;
+	uint32_t window;  /* Frames in the sliding window */
+	int64_t bias;  /* Q19 */
+	int64_t machine_logit;  /* Q19, logit at or above which the call is a machine */
+	int64_t person_logit;  /* Q19, logit at or below which the call is a person */
+	int16_t weights[AMD_MODEL_MAX_WINDOW * AMD_MODEL_FEATURES];  /* Q12, oldest frame first */
+} amd_model_t;
+
+/* The model used by amd_model_engine */
+extern amd_model_t amd_model;
+
+int amd_model_load(const char *path, amd_model_t *m);
+
+/* Average and worst model inference time of a model engine state, 0 if none ran */
+int amd_model_metrics(const void *state, uint64_t *avg_ns, uint64_t *max_ns);
+
+/* Monotonic clock in ns */
+uint64_t amd_now_ns(void);
+
+/* log2(v) in Q7 */
+int32_t amd_log2_q7(uint64_t v);
+
+/*
+ * Average absolute amplitude of the callee channel, normalized to 8kHz
+ * (the original mod_amd score). With write_score and a stereo frame, the
+ * score of our side is computed in the same pass.
+ */
+uint32_t amd_frame_score(const amd_pcm_t *pcm, uint32_t *write_score);
+
+static inline amd_frame_classifier amd_classify_frame(const amd_pcm_t *pcm, uint32_t threshold, uint32_t *write_score)
+{
+	return amd_frame_score(pcm, write_score) >= threshold ? VOICED : SILENCE;
+}
+
+/*
+ * Fingerprint of a greeting: log2 energy of the AMD_FP_FRAMES frames that
+ * follow the first voiced frame, each quantized to 3 bits relative to that
+ * first frame, so the key ignores answer delay and moderate gain
+ * differences. Bins are 1.5 bits (~4.5dB) wide, floored, with the first
+ * frame's level in the middle of bin 4. Keys whose levels change fewer than
+ * AMD_FP_MIN_CHANGES times are flat (a tone, steady noise, a held vowel)
+ * and would match any steady opening, so they are never looked up or learned.
+ */
+#define AMD_FP_FRAMES 16
+#define AMD_FP_STEP 192  /* 1.5 in Q7 */
+#define AMD_FP_MIN_CHANGES 3
+
+/* Non-zero when a complete key has enough level changes to identify a greeting */
+int amd_fp_key_usable(uint64_t key);
+
+/*
+ * Add one frame to hot->fp_key; 1 once a usable key is complete, fp_key is 0
+ * if rejected. pcm NULL is a frame skipped by load shedding: it repeats the
+ * previous level without looking at audio.
+ */
+int amd_fp_update(amd_vad_hot_t *hot, const amd_pcm_t *pcm, amd_frame_classifier frame_type);
+
+/* Parse voice_start style "name=value,..." overrides into p */
+void amd_params_parse(amd_params_t *p, const char *data, const void *owner);
+
+/* Per-session value where set, else the default, into a fresh hot block */
+void amd_resolve_params(amd_vad_hot_t *hot, const amd_params_t *p, const amd_params_t *defaults);
+
+/* Account one frame of audio; AMD_VERDICT_TOO_LONG once total_analysis_time is used up */
+amd_verdict_t amd_advance(amd_vad_hot_t *hot, const amd_pcm_t *pcm);
+
+/* Run the engine on the callee channel, scoring our side too in dual mode */
+amd_frame_classifier amd_engine_frame(amd_vad_hot_t *hot, const amd_engine_t *engine, void *state,
+									  const amd_pcm_t *pcm, amd_verdict_t *verdict);
+
+/* Advance the word-count state machine, then the dual-direction rules */
+amd_verdict_t amd_sm_step(amd_vad_hot_t *hot, amd_frame_classifier frame_type);
+amd_verdict_t amd_dual_step(amd_vad_hot_t *hot, amd_frame_classifier frame_type);
+
+static inline amd_verdict_t amd_step(amd_vad_hot_t *hot, amd_frame_classifier frame_type)
+{
+	amd_verdict_t verdict = amd_sm_step(hot, frame_type);
+
+	if (verdict == AMD_VERDICT_NONE && hot->dual) {
+		verdict = amd_dual_step(hot, frame_type);
+	}
+
+	return verdict;
+}
+
+#endif
@@ -2,6 +2,16 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "amd_core.h"
 
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_amd_shutdown);
 SWITCH_MODULE_LOAD_FUNCTION(mod_amd_load);
@@ -10,9 +20,22 @@ SWITCH_MODULE_DEFINITION(mod_free_amd, mod_amd_load, mod_amd_shutdown, NULL);
 static switch_hash_t *bug_hash = NULL;
 static switch_mutex_t *bug_hash_mutex = NULL;
 
+static struct {
+	switch_mutex_t *mutex;
+	switch_memory_pool_t *pool;
+	void *free_list;
+	uint32_t slabs;
+	uint32_t in_use;
+	uint32_t peak;
+} hot_slab;
+
 SWITCH_STANDARD_APP(voice_start_function);
 SWITCH_STANDARD_APP(voice_stop_function);
 SWITCH_STANDARD_APP(waitforresult_function);
+SWITCH_STANDARD_API(amd_stats_function);
+SWITCH_STANDARD_API(amd_list_function);
+SWITCH_STANDARD_API(amd_status_function);
+SWITCH_STANDARD_API(amd_profile_function);
 
 static struct {
 	uint32_t silent_threshold;
@@ -25,8 +48,100 @@ static struct {
 	uint32_t noise_max_count;
 	uint32_t total_analysis_time;
 	uint32_t debug;
+	uint32_t dual;
+	uint32_t response_window;
+	uint32_t prompt_min_length;
+	char *engine;
+	char *model_file;
+	uint32_t fingerprint_cache_size;
+	uint32_t fingerprint_ttl;
+	char *fingerprint_file;
+	uint32_t max_sessions;
+	uint32_t degrade_sessions;
+	uint32_t degrade_frame_ns;
+	uint32_t degrade_decimation;
 } globals;
 
+/* Load counters; per-frame counts are folded in when a detection closes */
+static struct {
+	uint32_t active;
+	uint32_t peak;
+	uint64_t started;
+	uint64_t rejected;
+	uint64_t frames;
+	uint64_t skipped_frames;
+	uint64_t frame_ns;  /* Moving average of sampled engine cost per frame */
+	uint64_t dual_frame_ns;  /* Same, for dual-direction detections */
+	uint64_t decisions;
+	uint64_t decision_ms;  /* Sum of analysis time to verdict */
+	uint64_t dual_decisions;
+	uint64_t dual_decision_ms;
+} load;
+
+/*
+ * Profiling of the READ path, off unless enabled with amd_profile. Stages
+ * of each analyzed frame are timed with the TSC (clock_gettime elsewhere),
+ * summed per thread, and folded into per codec/rate buckets every
+ * AMD_PROF_FLUSH frames and when a detection closes.
+ */
+typedef enum {
+	AMD_PROF_BUG_READ,
+	AMD_PROF_READ_IMPL,
+	AMD_PROF_CLASSIFY,
+	AMD_PROF_STATE_MACHINE,
+	AMD_PROF_PUBLISH,
+	AMD_PROF_STAGES
+} amd_prof_stage_t;
+
+static const char *amd_prof_stage_names[AMD_PROF_STAGES] = {
+	"bug_read",
+	"read_impl",
+	"classify",
+	"state_machine",
+	"publish"
+};
+
+#define AMD_PROF_BUCKETS 16  /* Codec/rate pairs; the last one also takes any overflow */
+#define AMD_PROF_FLUSH 64
+
+typedef struct {
+	char codec[32];
+	uint32_t rate;
+	uint64_t frames;
+	uint64_t ticks[AMD_PROF_STAGES];
+} amd_prof_bucket_t;
+
+static struct {
+	switch_mutex_t *mutex;
+	uint32_t generation;  /* Bumped by reset; per-thread sums of an older generation are dropped */
+	uint64_t ticks_per_us;
+	const char *clock;  /* Source amd_prof_ticks reads, set with ticks_per_us */
+	switch_time_t started;
+	switch_time_t stopped;
+	uint32_t buckets_used;
+	amd_prof_bucket_t buckets[AMD_PROF_BUCKETS];
+} profile;
+
+/* Read on every frame, written only by amd_profile */
+static uint32_t profile_enabled;
+
+/* Stage timestamps of one READ invocation */
+typedef struct {
+	uint64_t last;
+	uint64_t ticks[AMD_PROF_STAGES];
+} amd_prof_t;
+
+typedef struct {
+	uint32_t generation;
+	const char *codec_ptr;  /* iananame of the bucket being summed, compared by pointer first */
+	char codec[32];
+	uint32_t rate;
+	uint32_t frames;
+	uint64_t ticks[AMD_PROF_STAGES];
+} amd_prof_local_t;
+
+static __thread amd_prof_local_t prof_local;
+
 static switch_xml_config_item_t instructions[] = {
 	SWITCH_CONFIG_ITEM(
 		"silent_threshold",
@@ -108,6 +223,102 @@ static switch_xml_config_item_t instructions[] = {
 		(void *) 0,
 		NULL, NULL, NULL),
 
+	SWITCH_CONFIG_ITEM(
+		"dual",
+		SWITCH_CONFIG_INT,
+		CONFIG_RELOADABLE,
+		&globals.dual,
+		(void *) 0,
+		NULL, NULL, NULL),
+
+	SWITCH_CONFIG_ITEM(
+		"response_window",
+		SWITCH_CONFIG_INT,
+		CONFIG_RELOADABLE,
+		&globals.response_window,
+		(void *) 1000,
+		NULL, NULL, NULL),
+
+	SWITCH_CONFIG_ITEM(
+		"prompt_min_length",
+		SWITCH_CONFIG_INT,
+		CONFIG_RELOADABLE,
+		&globals.prompt_min_length,
+		(void *) 500,
+		NULL, NULL, NULL),
+
+	SWITCH_CONFIG_ITEM(
+		"engine",
+		SWITCH_CONFIG_STRING,
+		CONFIG_RELOADABLE,
+		&globals.engine,
+		"energy",
+		NULL, NULL, NULL),
+
+	SWITCH_CONFIG_ITEM(
+		"model_file",
+		SWITCH_CONFIG_STRING,
+		CONFIG_RELOADABLE,
+		&globals.model_file,
+		"",
+		NULL, NULL, NULL),
+
+	SWITCH_CONFIG_ITEM(
+		"fingerprint_cache_size",
+		SWITCH_CONFIG_INT,
+		CONFIG_RELOADABLE,
+		&globals.fingerprint_cache_size,
+		(void *) 0,
+		NULL, NULL, NULL),
+
+	SWITCH_CONFIG_ITEM(
+		"fingerprint_ttl",
+		SWITCH_CONFIG_INT,
+		CONFIG_RELOADABLE,
+		&globals.fingerprint_ttl,
+		(void *) 86400,
+		NULL, NULL, NULL),
+
+	SWITCH_CONFIG_ITEM(
+		"fingerprint_file",
+		SWITCH_CONFIG_STRING,
+		CONFIG_RELOADABLE,
+		&globals.fingerprint_file,
+		"",
+		NULL, NULL, NULL),
+
+	SWITCH_CONFIG_ITEM(
+		"max_sessions",
+		SWITCH_CONFIG_INT,
+		CONFIG_RELOADABLE,
+		&globals.max_sessions,
+		(void *) 0,
+		NULL, NULL, NULL),
+
+	SWITCH_CONFIG_ITEM(
+		"degrade_sessions",
+		SWITCH_CONFIG_INT,
+		CONFIG_RELOADABLE,
+		&globals.degrade_sessions,
+		(void *) 0,
+		NULL, NULL, NULL),
+
+	SWITCH_CONFIG_ITEM(
+		"degrade_frame_ns",
+		SWITCH_CONFIG_INT,
+		CONFIG_RELOADABLE,
+		&globals.degrade_frame_ns,
+		(void *) 0,
+		NULL, NULL, NULL),
+
+	SWITCH_CONFIG_ITEM(
+		"degrade_decimation",
+		SWITCH_CONFIG_INT,
+		CONFIG_RELOADABLE,
+		&globals.degrade_decimation,
+		(void *) 2,
+		NULL, NULL, NULL),
+
 	SWITCH_CONFIG_ITEM_END()
 };
 
@@ -119,18 +330,199 @@ static switch_status_t do_config(switch_bool_t reload)
 		return SWITCH_STATUS_FALSE;
 	}
 
+	if (globals.model_file && strlen(globals.model_file)) {
+		amd_model_load(globals.model_file, &amd_model);
+	}
+
 	return SWITCH_STATUS_SUCCESS;
 }
 
+/*
+ * Greeting fingerprint cache
+ *
+ * Open-addressing table of fingerprints of known machine greetings, shared
+ * by all sessions and optionally backed by an mmap'ed file so it survives
+ * restarts and can be shared between instances. Readers and writers never
+ * lock: keys are published with compare-and-swap and a slot is reused once
+ * its TTL has expired. A key of 0 marks an empty slot.
+ */
+#define AMD_FP_MAGIC "AMDFP002"  /* Bumped when the key format changes */
+#define AMD_FP_PROBES 8
+
+typedef struct {
+	uint64_t key;
+	uint32_t expires;  /* Epoch seconds */
+	uint32_t hits;
+} amd_fp_entry_t;
+
+typedef struct {
+	char magic[8];
+	uint32_t size;
+	uint32_t reserved;
+} amd_fp_header_t;
+
+static struct {
+	amd_fp_entry_t *entries;
+	uint32_t mask;
+	void *map;
+	size_t map_len;
+	uint64_t lookups;
+	uint64_t hits;
+	uint64_t inserts;
+} fp_cache;
+
+static uint32_t fingerprint_slot(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (uint32_t) key & fp_cache.mask;
+}
+
+static void fingerprint_cache_init(switch_memory_pool_t *pool)
+{
+	uint32_t size = 1;
+	size_t len;
+
+	if (!globals.fingerprint_cache_size) {
+		return;
+	}
+
+	while (size < globals.fingerprint_cache_size) {
+		size <<= 1;
+	}
+	len = sizeof(amd_fp_header_t) + (size_t) size * sizeof(amd_fp_entry_t);
+
+	if (globals.fingerprint_file && strlen(globals.fingerprint_file)) {
+		int fd = open(globals.fingerprint_file, O_RDWR | O_CREAT, 0640);
+
+		if (fd >= 0 && ftruncate(fd, len) == 0) {
+			void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+			if (map != MAP_FAILED) {
+				amd_fp_header_t *hdr = (amd_fp_header_t *) map;
+
+				if (memcmp(hdr->magic, AMD_FP_MAGIC, sizeof(hdr->magic)) || hdr->size != size) {
+					memset(map, 0, len);
+					memcpy(hdr->magic, AMD_FP_MAGIC, sizeof(hdr->magic));
+					hdr->size = size;
+				}
+				fp_cache.map = map;
+				fp_cache.map_len = len;
+				fp_cache.entries = (amd_fp_entry_t *) (hdr + 1);
+			}
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+		if (!fp_cache.entries) {
+			switch_log_printf(
+				SWITCH_CHANNEL_LOG,
+				SWITCH_LOG_WARNING,
+				"AMD: Cannot map fingerprint file %s, using process memory\n",
+				globals.fingerprint_file);
+		}
+	}
+
+	if (!fp_cache.entries) {
+		fp_cache.entries = switch_core_alloc(pool, (size_t) size * sizeof(amd_fp_entry_t));
+		memset(fp_cache.entries, 0, (size_t) size * sizeof(amd_fp_entry_t));
+	}
+	fp_cache.mask = size - 1;
+}
+
+static void fingerprint_cache_destroy(void)
+{
+	if (fp_cache.map) {
+		munmap(fp_cache.map, fp_cache.map_len);
+	}
+	memset(&fp_cache, 0, sizeof(fp_cache));
+}
+
+static switch_bool_t fingerprint_cache_lookup(uint64_t key)
+{
+	uint32_t now = (uint32_t) switch_epoch_time_now(NULL);
+	uint32_t slot = fingerprint_slot(key), i;
+
+	if (!amd_fp_key_usable(key)) {
+		return SWITCH_FALSE;
+	}
+
+	__atomic_add_fetch(&fp_cache.lookups, 1, __ATOMIC_RELAXED);
+
+	for (i = 0; i < AMD_FP_PROBES; i++) {
+		amd_fp_entry_t *e = &fp_cache.entries[(slot + i) & fp_cache.mask];
+
+		if (__atomic_load_n(&e->key, __ATOMIC_ACQUIRE) == key) {
+			uint32_t expires = __atomic_load_n(&e->expires, __ATOMIC_ACQUIRE);
+
+			/* The slot may have been reclaimed since the key load; that expiry is not ours */
+			if (__atomic_load_n(&e->key, __ATOMIC_RELAXED) != key) {
+				return SWITCH_FALSE;
+			}
+			if (expires > now) {
+				__atomic_add_fetch(&e->hits, 1, __ATOMIC_RELAXED);
+				__atomic_add_fetch(&fp_cache.hits, 1, __ATOMIC_RELAXED);
+				return SWITCH_TRUE;
+			}
+			return SWITCH_FALSE;
+		}
+	}
+
+	return SWITCH_FALSE;
+}
+
+static void fingerprint_cache_insert(uint64_t key)
+{
+	uint32_t now = (uint32_t) switch_epoch_time_now(NULL);
+	uint32_t expires = now + globals.fingerprint_ttl;
+	uint32_t slot = fingerprint_slot(key), i;
+
+	if (!amd_fp_key_usable(key)) {
+		return;
+	}
+
+	for (i = 0; i < AMD_FP_PROBES; i++) {
+		amd_fp_entry_t *e = &fp_cache.entries[(slot + i) & fp_cache.mask];
+		uint64_t old = __atomic_load_n(&e->key, __ATOMIC_ACQUIRE);
+
+		if (old == key) {
+			__atomic_store_n(&e->expires, expires, __ATOMIC_RELAXED);
+			return;
+		}
+
+		if (old == 0 || __atomic_load_n(&e->expires, __ATOMIC_RELAXED) <= now) {
+			/*
+			 * Claim the slot before touching its payload: a writer that loses
+			 * the race leaves the winner's expiry alone. Until the expiry store
+			 * below lands, readers of the new key see the old, already passed
+			 * expiry and miss; readers still holding the old key re-check it
+			 * after loading the expiry and miss too.
+			 */
+			if (__atomic_compare_exchange_n(&e->key, &old, key, SWITCH_FALSE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+				__atomic_store_n(&e->hits, 0, __ATOMIC_RELAXED);
+				__atomic_store_n(&e->expires, expires, __ATOMIC_RELEASE);
+				__atomic_add_fetch(&fp_cache.inserts, 1, __ATOMIC_RELAXED);
+				return;
+			}
+		}
+	}
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_amd_load)
 {
 	switch_application_interface_t *app_interface;
+	switch_api_interface_t *api_interface;
 
 	*module_interface = switch_loadable_module_create_module_interface(pool, modname);
 
 	do_config(SWITCH_FALSE);
+	fingerprint_cache_init(pool);
 
 	switch_mutex_init(&bug_hash_mutex, SWITCH_MUTEX_NESTED, pool);
+	switch_mutex_init(&hot_slab.mutex, SWITCH_MUTEX_NESTED, pool);
+	switch_mutex_init(&profile.mutex, SWITCH_MUTEX_NESTED, pool);
+	hot_slab.pool = pool;
 	switch_core_hash_init(&bug_hash);
 
 	SWITCH_ADD_APP(
@@ -160,11 +552,44 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_amd_load)
 		NULL,
 		SAF_NONE);
 
+	SWITCH_ADD_API(
+		api_interface,
+		"amd_stats",
+		"Show AMD memory footprint and counters",
+		amd_stats_function,
+		"");
+
+	SWITCH_ADD_API(
+		api_interface,
+		"amd_list",
+		"List active AMD detections as JSON",
+		amd_list_function,
+		"");
+
+	SWITCH_ADD_API(
+		api_interface,
+		"amd_status",
+		"Show one active AMD detection as JSON",
+		amd_status_function,
+		"<uuid>");
+	switch_console_set_complete("add amd_status ::console::list_uuid");
+
+	SWITCH_ADD_API(
+		api_interface,
+		"amd_profile",
+		"Profile the AMD frame path by stage and codec",
+		amd_profile_function,
+		"[on|off|reset]");
+	switch_console_set_complete("add amd_profile on");
+	switch_console_set_complete("add amd_profile off");
+	switch_console_set_complete("add amd_profile reset");
+
 	return SWITCH_STATUS_SUCCESS;
 }
 
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_amd_shutdown)
 {
+	fingerprint_cache_destroy();
 	switch_xml_config_cleanup(instructions);
 	if (bug_hash_mutex) {
 		switch_mutex_destroy(bug_hash_mutex);
@@ -174,16 +599,6 @@ SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_amd_shutdown)
 	return SWITCH_STATUS_SUCCESS;
 }
 
-typedef enum {
-	SILENCE,
-	VOICED
-} amd_frame_classifier;
-
-typedef enum {
-	VAD_STATE_IN_WORD,
-	VAD_STATE_IN_SILENCE,
-} amd_vad_state_t;
-
 /* Helper structure to access media bug frame (matches internal layout) */
 typedef struct {
 	void *session;
@@ -193,46 +608,147 @@ typedef struct {
 	/* ... other fields ... */
 } amd_media_bug_helper_t;
 
+/* Per-session context; the head holds the pointers used on every frame */
 typedef struct {
+	amd_vad_hot_t *hot;
+	const struct amd_engine_s *engine;  /* Frame classification engine */
+	void *engine_state;  /* Per-session engine state, engine->footprint() bytes */
 	switch_core_session_t *session;
 	switch_channel_t *channel;
 	switch_media_bug_t *bug;
+
 	switch_codec_t raw_codec;  /* L16 codec for decoding frames */
-	amd_vad_state_t state;
-	uint32_t frame_ms;
+	char read_codec[32];  /* Channel read codec before raw_codec replaced it, for amd_profile */
+	uint32_t read_rate;
+	amd_params_t params;
+	uint32_t codec_initialized:1;  /* Track if L16 codec is initialized */
 
-	uint32_t silence_duration;
-	uint32_t voice_duration;
-	uint32_t words;  /* Total word count (throughout entire detection, including intro) */
-	uint32_t intro_words;  /* Word count during intro period (first noise_max_intro ms) */
-	uint32_t intro_voice_duration;
-	uint32_t total_duration;
-	uint32_t last_noise_start;
-	uint32_t last_noise_end;
-	uint32_t current_word_duration;
-	uint32_t word_counted:1;
+	/* waitforresult handshake, both flags under wait_mutex */
+	switch_mutex_t *wait_mutex;
+	uint32_t waiting:1;  /* waitforresult is playing a prompt */
+	uint32_t result_queued:1;  /* A Result event is queued and not yet consumed */
+} amd_vad_t;
 
-	/* Per-session configuration (0 means use global) */
-	uint32_t silent_threshold;
-	uint32_t silent_initial;
-	uint32_t silent_after_intro;
-	uint32_t silent_max_session;
-	uint32_t noise_max_intro;
-	uint32_t noise_min_length;
-	uint32_t noise_inter_silence;
-	uint32_t noise_max_count;
-	uint32_t total_analysis_time;
-	uint32_t debug;
+/* Log hook for amd_core.c; owner is the session's amd_vad_t */
+void amd_core_log(const void *owner, amd_log_level_t level, const char *fmt, ...)
+{
+	const amd_vad_t *vad = (const amd_vad_t *) owner;
+	switch_log_level_t switch_level;
+	char *msg = NULL;
+	va_list ap;
+
+	switch (level) {
+	case AMD_LOG_ERROR:
+		switch_level = SWITCH_LOG_ERROR;
+		break;
+	case AMD_LOG_WARNING:
+		switch_level = SWITCH_LOG_WARNING;
+		break;
+	case AMD_LOG_INFO:
+		switch_level = SWITCH_LOG_INFO;
+		break;
+	default:
+		switch_level = SWITCH_LOG_DEBUG;
+		break;
+	}
 
-	uint32_t in_initial_silence:1;
-	uint32_t in_intro:1;
-	uint32_t complete:1;
-	uint32_t max_intro_checked:1;  /* Flag to track if max-intro has been checked (only once for first word) */
-	uint32_t silent_after_intro_checked:1;  /* Flag to track if silent-after-intro has been checked (only once after first word) */
-	uint32_t talking:1;
-	uint32_t had_silence_break:1;  /* Track if we had a silence break during intro */
-	uint32_t codec_initialized:1;  /* Track if L16 codec is initialized */
-} amd_vad_t;
+	va_start(ap, fmt);
+	if (switch_vasprintf(&msg, fmt, ap) < 0) {
+		msg = NULL;
+	}
+	va_end(ap);
+
+	if (!msg) {
+		return;
+	}
+
+	if (vad && vad->session) {
+		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(vad->session), switch_level, "%s", msg);
+	} else {
+		switch_log_printf(SWITCH_CHANNEL_LOG, switch_level, "%s", msg);
+	}
+	free(msg);
+}
+
+/*
+ * Hot block slab. Blocks are carved from AMD_SLAB_BLOCKS-sized slabs taken
+ * from the module pool and recycled through a free list; slabs are never
+ * returned, so a stale pointer to a block is always readable memory.
+ */
+#define AMD_SLAB_BLOCKS 256
+
+static amd_vad_hot_t *hot_alloc(void)
+{
+	amd_vad_hot_t *hot;
+
+	switch_mutex_lock(hot_slab.mutex);
+	if (!hot_slab.free_list) {
+		char *slab = switch_core_alloc(hot_slab.pool, AMD_SLAB_BLOCKS * sizeof(amd_vad_hot_t) + 64);
+		amd_vad_hot_t *blocks = (amd_vad_hot_t *) (((uintptr_t) slab + 63) & ~(uintptr_t) 63);
+		int i;
+
+		for (i = 0; i < AMD_SLAB_BLOCKS; i++) {
+			*(void **) &blocks[i] = hot_slab.free_list;
+			hot_slab.free_list = &blocks[i];
+		}
+		hot_slab.slabs++;
+	}
+	hot = (amd_vad_hot_t *) hot_slab.free_list;
+	hot_slab.free_list = *(void **) hot;
+	if (++hot_slab.in_use > hot_slab.peak) {
+		hot_slab.peak = hot_slab.in_use;
+	}
+	switch_mutex_unlock(hot_slab.mutex);
+
+	memset(hot, 0, sizeof(*hot));
+	return hot;
+}
+
+static void hot_free(amd_vad_hot_t *hot)
+{
+	__atomic_store_n(&hot->owner, NULL, __ATOMIC_RELEASE);
+	switch_mutex_lock(hot_slab.mutex);
+	*(void **) hot = hot_slab.free_list;
+	hot_slab.free_list = hot;
+	hot_slab.in_use--;
+	switch_mutex_unlock(hot_slab.mutex);
+}
+
+/* Seqlock writer side, media thread only */
+static inline void amd_seq_begin(amd_vad_hot_t *hot)
+{
+	__atomic_store_n(&hot->seq, hot->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void amd_seq_end(amd_vad_hot_t *hot)
+{
+	__atomic_store_n(&hot->seq, hot->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Resolve per-session parameters against amd.conf.xml into the hot block */
+static void resolve_params(amd_vad_t *vad)
+{
+	amd_params_t defaults = { 0 };
+
+	defaults.silent_threshold = globals.silent_threshold;
+	defaults.silent_initial = globals.silent_initial;
+	defaults.silent_after_intro = globals.silent_after_intro;
+	defaults.silent_max_session = globals.silent_max_session;
+	defaults.noise_max_intro = globals.noise_max_intro;
+	defaults.noise_min_length = globals.noise_min_length;
+	defaults.noise_inter_silence = globals.noise_inter_silence;
+	defaults.noise_max_count = globals.noise_max_count;
+	defaults.total_analysis_time = globals.total_analysis_time;
+	defaults.debug = globals.debug;
+	defaults.dual = globals.dual;
+	defaults.response_window = globals.response_window;
+	defaults.prompt_min_length = globals.prompt_min_length;
+
+	amd_resolve_params(vad->hot, &vad->params, &defaults);
+}
+
+static void fingerprint_learn(amd_vad_t *vad, const char *status, const char *result);
 
 static void fire_custom_event(switch_core_session_t *session, const char *action)
 {
@@ -255,115 +771,449 @@ static void fire_media_bug_event(switch_core_session_t *session, const char *eve
 	}
 }
 
-static uint32_t get_silent_threshold(amd_vad_t *vad)
+static void model_publish_metrics(amd_vad_t *vad)
 {
-	return vad->silent_threshold ? vad->silent_threshold : globals.silent_threshold;
+	uint64_t avg_ns, max_ns;
+
+	if (vad->engine != &amd_model_engine || !amd_model_metrics(vad->engine_state, &avg_ns, &max_ns)) {
+		return;
+	}
+
+	switch_channel_set_variable_printf(vad->channel, "amd_model_inference_ns", "%" PRIu64, avg_ns);
+	switch_channel_set_variable_printf(vad->channel, "amd_model_inference_max_ns", "%" PRIu64, max_ns);
 }
 
-static uint32_t get_silent_initial(amd_vad_t *vad)
+/* Publish a verdict on the channel and stop further analysis */
+static void amd_set_result(amd_vad_t *vad, const char *status, const char *result)
 {
-	return vad->silent_initial ? vad->silent_initial : globals.silent_initial;
+	amd_vad_hot_t *hot = vad->hot;
+
+	fingerprint_learn(vad, status, result);
+	model_publish_metrics(vad);
+	switch_channel_set_variable(vad->channel, "amd_status", status);
+	switch_channel_set_variable(vad->channel, "amd_result", result);
+	switch_channel_set_variable_printf(vad->channel, "amd_decision_ms", "%u", hot->total_duration);
+	hot->complete = SWITCH_TRUE;
+
+	/* Cut the waitforresult prompt: its input callback breaks on this event */
+	switch_mutex_lock(vad->wait_mutex);
+	if (vad->waiting) {
+		switch_event_t *event;
+
+		if (switch_event_create(&event, SWITCH_EVENT_CUSTOM) == SWITCH_STATUS_SUCCESS) {
+			switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Event-Subclass", "AMD::EVENT");
+			switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Action", "Result");
+			switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "AMD-Status", status);
+			switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "AMD-Result", result);
+			if (switch_core_session_queue_event(vad->session, &event) == SWITCH_STATUS_SUCCESS) {
+				vad->result_queued = 1;
+			} else {
+				switch_event_destroy(&event);
+			}
+		}
+	}
+	switch_mutex_unlock(vad->wait_mutex);
+
+	if (hot->dual) {
+		__atomic_add_fetch(&load.dual_decisions, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&load.dual_decision_ms, hot->total_duration, __ATOMIC_RELAXED);
+	} else {
+		__atomic_add_fetch(&load.decisions, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&load.decision_ms, hot->total_duration, __ATOMIC_RELAXED);
+	}
 }
 
-static uint32_t get_silent_after_intro(amd_vad_t *vad)
+/* Only computed while the fingerprint is being built, and only when the cache is enabled; pcm NULL on skipped frames */
+static void fingerprint_update(amd_vad_t *vad, const amd_pcm_t *pcm, amd_frame_classifier frame_type)
 {
-	return vad->silent_after_intro ? vad->silent_after_intro : globals.silent_after_intro;
+	if (vad->hot->fp_done || !fp_cache.entries || !amd_fp_update(vad->hot, pcm, frame_type)) {
+		return;
+	}
+
+	if (fingerprint_cache_lookup(vad->hot->fp_key)) {
+		if (vad->hot->debug) {
+			switch_log_printf(
+				SWITCH_CHANNEL_SESSION_LOG(vad->session),
+				SWITCH_LOG_DEBUG,
+				"AMD: Machine detected - fingerprint %016" PRIx64 " (total_duration: %d)\n",
+				vad->hot->fp_key, vad->hot->total_duration);
+		}
+		amd_set_result(vad, amd_verdicts[AMD_VERDICT_FINGERPRINT].status, amd_verdicts[AMD_VERDICT_FINGERPRINT].result);
+	}
 }
 
-static uint32_t get_silent_max_session(amd_vad_t *vad)
+/* Remember the greeting of a call the rules decided was a machine */
+static void fingerprint_learn(amd_vad_t *vad, const char *status, const char *result)
 {
-	return vad->silent_max_session ? vad->silent_max_session : globals.silent_max_session;
+	if (!fp_cache.entries || !vad->hot->fp_done || !vad->hot->fp_key || strcmp(status, "machine") || !strcmp(result, "fingerprint")) {
+		return;
+	}
+
+	fingerprint_cache_insert(vad->hot->fp_key);
 }
 
-static uint32_t get_noise_max_intro(amd_vad_t *vad)
+/*
+ * Overload handling
+ *
+ * Past degrade_sessions concurrent detections, or when the sampled engine
+ * cost per frame averages above degrade_frame_ns, only one frame in
+ * degrade_decimation is classified; the others repeat the last decision so
+ * durations keep advancing at the real frame rate.
+ */
+#define AMD_COST_SAMPLE_MASK 31  /* Time one frame in 32 per session */
+
+static switch_bool_t amd_degraded(void)
 {
-	return vad->noise_max_intro ? vad->noise_max_intro : globals.noise_max_intro;
+	if (globals.degrade_decimation < 2) {
+		return SWITCH_FALSE;
+	}
+
+	return (globals.degrade_sessions && __atomic_load_n(&load.active, __ATOMIC_RELAXED) > globals.degrade_sessions) ||
+		(globals.degrade_frame_ns && (__atomic_load_n(&load.frame_ns, __ATOMIC_RELAXED) > globals.degrade_frame_ns ||
+									  __atomic_load_n(&load.dual_frame_ns, __ATOMIC_RELAXED) > globals.degrade_frame_ns));
 }
 
-static uint32_t get_noise_min_length(amd_vad_t *vad)
+/* Run the session's engine on a frame, or repeat the last decision when degraded */
+static amd_frame_classifier amd_classify(amd_vad_t *vad, const amd_pcm_t *pcm, amd_verdict_t *verdict)
 {
-	return vad->noise_min_length ? vad->noise_min_length : globals.noise_min_length;
+	amd_vad_hot_t *hot = vad->hot;
+	amd_frame_classifier frame_type;
+
+	hot->frames++;
+
+	if (amd_degraded() && (hot->frames % globals.degrade_decimation)) {
+		*verdict = AMD_VERDICT_NONE;
+		hot->skipped_frames++;
+		return hot->last_frame_type;
+	}
+
+	if (hot->frames & AMD_COST_SAMPLE_MASK) {
+		frame_type = amd_engine_frame(hot, vad->engine, vad->engine_state, pcm, verdict);
+	} else {
+		uint64_t *cost = hot->dual ? &load.dual_frame_ns : &load.frame_ns;
+		uint64_t start = amd_now_ns(), avg;
+
+		frame_type = amd_engine_frame(hot, vad->engine, vad->engine_state, pcm, verdict);
+
+		/* Racy read-modify-write is fine for a moving average */
+		avg = __atomic_load_n(cost, __ATOMIC_RELAXED);
+		avg = avg - (avg >> 4) + ((amd_now_ns() - start) >> 4);
+		__atomic_store_n(cost, avg, __ATOMIC_RELAXED);
+	}
+
+	hot->last_frame_type = frame_type;
+	return frame_type;
 }
 
-static uint32_t get_noise_inter_silence(amd_vad_t *vad)
+/* Claim a detection slot, honouring max_sessions */
+static switch_bool_t amd_admit(void)
 {
-	return vad->noise_inter_silence ? vad->noise_inter_silence : globals.noise_inter_silence;
+	uint32_t active = __atomic_add_fetch(&load.active, 1, __ATOMIC_RELAXED);
+
+	if (globals.max_sessions && active > globals.max_sessions) {
+		__atomic_sub_fetch(&load.active, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&load.rejected, 1, __ATOMIC_RELAXED);
+		return SWITCH_FALSE;
+	}
+
+	__atomic_add_fetch(&load.started, 1, __ATOMIC_RELAXED);
+	if (active > __atomic_load_n(&load.peak, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&load.peak, active, __ATOMIC_RELAXED);
+	}
+
+	return SWITCH_TRUE;
 }
 
-static uint32_t get_noise_max_count(amd_vad_t *vad)
+static void amd_release(const amd_vad_hot_t *hot)
 {
-	return vad->noise_max_count ? vad->noise_max_count : globals.noise_max_count;
+	__atomic_add_fetch(&load.frames, hot->frames, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&load.skipped_frames, hot->skipped_frames, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&load.active, 1, __ATOMIC_RELAXED);
 }
 
-static uint32_t get_total_analysis_time(amd_vad_t *vad)
+static inline uint64_t amd_prof_ticks(void)
 {
-	return vad->total_analysis_time ? vad->total_analysis_time : globals.total_analysis_time;
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return amd_now_ns();
+#endif
 }
 
-static uint32_t get_debug(amd_vad_t *vad)
+/* Charge the time since the previous mark to a stage; no-op unless profiling */
+static inline void amd_prof_mark(amd_prof_t *prof, amd_prof_stage_t stage)
 {
-	return vad->debug ? vad->debug : globals.debug;
+	uint64_t now;
+
+	if (!prof) {
+		return;
+	}
+
+	now = amd_prof_ticks();
+	prof->ticks[stage] += now - prof->last;
+	prof->last = now;
 }
 
-/* Classify L16 PCM frame - assumes frame is already decoded to L16 */
-static amd_frame_classifier classify_frame(const switch_frame_t *f, const switch_codec_implementation_t *codec, uint32_t threshold)
+/* Fold this thread's sums into the codec/rate bucket */
+static void amd_prof_flush(void)
 {
-	int16_t *audio = (int16_t *)f->data;
-	uint32_t score, count, j;
-	double energy;
-	int divisor;
-	uint32_t channels;
+	amd_prof_local_t *local = &prof_local;
+	amd_prof_bucket_t *bucket = NULL;
+	uint32_t i;
 
-	/* Match original mod_amd exactly - simple and straightforward */
-	/* Reference: https://raw.githubusercontent.com/seanbright/mod_amd/master/mod_amd.c */
-	/* silent_threshold: The level of volume to consider talking or not talking */
-	/* score represents volume/energy - compare against threshold to classify */
-	/* Note: Frame must already be decoded to L16 PCM before calling this function */
+	if (!local->frames || !profile.mutex) {
+		return;
+	}
 
-	/* Use codec info if available, otherwise use frame info */
-	if (codec->actual_samples_per_second > 0) {
-		divisor = codec->actual_samples_per_second / 8000;
-	} else if (f->rate > 0) {
-		divisor = f->rate / 8000;
-	} else {
-		divisor = 1; /* Default to 8000Hz */
+	switch_mutex_lock(profile.mutex);
+	if (local->generation == profile.generation) {
+		for (i = 0; i < profile.buckets_used && !bucket; i++) {
+			if (profile.buckets[i].rate == local->rate && !strcmp(profile.buckets[i].codec, local->codec)) {
+				bucket = &profile.buckets[i];
+			}
+		}
+		if (!bucket) {
+			if (profile.buckets_used < AMD_PROF_BUCKETS) {
+				bucket = &profile.buckets[profile.buckets_used++];
+				switch_copy_string(bucket->codec, local->codec, sizeof(bucket->codec));
+				bucket->rate = local->rate;
+			} else {
+				bucket = &profile.buckets[AMD_PROF_BUCKETS - 1];
+			}
+		}
+
+		bucket->frames += local->frames;
+		for (i = 0; i < AMD_PROF_STAGES; i++) {
+			bucket->ticks[i] += local->ticks[i];
+		}
+	}
+	switch_mutex_unlock(profile.mutex);
+
+	memset(local, 0, sizeof(*local));
+}
+
+/* Add one profiled frame to this thread's sums */
+static void amd_prof_end(const amd_prof_t *prof, const char *codec, uint32_t rate)
+{
+	amd_prof_local_t *local = &prof_local;
+	uint32_t generation = __atomic_load_n(&profile.generation, __ATOMIC_RELAXED);
+	int i;
+
+	if (!codec) {
+		codec = "unknown";
+	}
+
+	if (local->frames && (local->generation != generation || local->rate != rate ||
+						  (local->codec_ptr != codec && strcmp(local->codec, codec)))) {
+		amd_prof_flush();
+	}
+
+	if (!local->frames) {
+		local->generation = generation;
+		local->codec_ptr = codec;
+		switch_copy_string(local->codec, codec, sizeof(local->codec));
+		local->rate = rate;
+	}
+
+	for (i = 0; i < AMD_PROF_STAGES; i++) {
+		local->ticks[i] += prof->ticks[i];
+	}
+
+	if (++local->frames >= AMD_PROF_FLUSH) {
+		amd_prof_flush();
+	}
+}
+
+/* Run detection on one decoded READ frame; inlined into both amd_read_frame copies */
+static inline __attribute__((always_inline)) void amd_process_read(amd_vad_t *vad, switch_frame_t *frame, const switch_codec_implementation_t *read_impl, amd_prof_t *prof)
+{
+	amd_vad_hot_t *hot = vad->hot;
+	amd_frame_classifier frame_type;
+	amd_verdict_t verdict;
+	amd_pcm_t pcm;
+	uint32_t words, skipped;
+
+	pcm.data = (const int16_t *) frame->data;
+	pcm.samples = frame->samples;
+	pcm.channels = read_impl->number_of_channels;
+	pcm.rate = read_impl->actual_samples_per_second;
+
+	/* Process frame immediately - calculate frame_ms and classify */
+	if (amd_advance(hot, &pcm) == AMD_VERDICT_TOO_LONG) {
+		amd_prof_mark(prof, AMD_PROF_STATE_MACHINE);
+		if (hot->debug) {
+			switch_log_printf(
+				SWITCH_CHANNEL_SESSION_LOG(vad->session),
+				SWITCH_LOG_DEBUG,
+				"AMD: Timeout - total_analysis_time exceeded\n");
+		}
+		amd_set_result(vad, amd_verdicts[AMD_VERDICT_TOO_LONG].status, amd_verdicts[AMD_VERDICT_TOO_LONG].result);
+		return;
+	}
+
+	/* Classify every frame with the session's engine */
+	skipped = hot->skipped_frames;
+	frame_type = amd_classify(vad, &pcm, &verdict);
+	amd_prof_mark(prof, AMD_PROF_CLASSIFY);
+
+	/* Engine may have reached a verdict on its own */
+	if (verdict != AMD_VERDICT_NONE) {
+		amd_set_result(vad, amd_verdicts[verdict].status, amd_verdicts[verdict].result);
+		return;
+	}
+
+	/* Known machine greeting? Frames skipped by load shedding skip its energy pass too */
+	fingerprint_update(vad, hot->skipped_frames == skipped ? &pcm : NULL, frame_type);
+	amd_prof_mark(prof, AMD_PROF_STATE_MACHINE);
+	if (hot->complete) {
+		return;
 	}
 
-	channels = (codec->number_of_channels > 0) ? codec->number_of_channels : (f->channels > 0 ? f->channels : 1);
+	if (hot->debug) {
+		switch_log_printf(
+			SWITCH_CHANNEL_SESSION_LOG(vad->session),
+			SWITCH_LOG_DEBUG,
+			"AMD: Frame processed - type=%s, total_duration=%d, intro_voice=%d, intro_words=%d, silence=%d, words=%d\n",
+			frame_type == VOICED ? "VOICED" : "SILENCE",
+			hot->total_duration,
+			hot->intro_voice_duration,
+			hot->intro_words,
+			hot->silence_duration,
+			hot->words);
+	}
 
-	/* Process as L16 PCM */
-	for (energy = 0, j = 0, count = 0; count < f->samples; count++) {
-		energy += abs(audio[j++]);
-		j += channels - 1;  /* Skip other channels to get next sample of same channel (for mono: no skip, for stereo: skip 1) */
+	if (frame_type == VOICED) {
+		if (!hot->talking) {
+			hot->talking = 1;
+			fire_custom_event(vad->session, "Start Talking");
+		}
+	} else if (hot->talking) {
+		hot->talking = 0;
+		fire_custom_event(vad->session, "Stop Talking");
 	}
 
-	score = (uint32_t) (energy / (f->samples / divisor));
+	amd_prof_mark(prof, AMD_PROF_PUBLISH);
 
-	if (score >= threshold) {
-		return VOICED;
+	words = hot->words;
+	verdict = amd_step(hot, frame_type);
+	amd_prof_mark(prof, AMD_PROF_STATE_MACHINE);
+
+	if (hot->words != words && hot->debug) {
+		switch_log_printf(
+			SWITCH_CHANNEL_SESSION_LOG(vad->session),
+			SWITCH_LOG_DEBUG,
+			"AMD: Word detected - words: %d, intro_words: %d, word_duration: %d, total_duration: %d\n",
+			hot->words, hot->intro_words, hot->current_word_duration, hot->total_duration);
 	}
 
-	return SILENCE;
+	if (verdict != AMD_VERDICT_NONE) {
+		if (hot->debug) {
+			switch_log_printf(
+				SWITCH_CHANNEL_SESSION_LOG(vad->session),
+				SWITCH_LOG_DEBUG,
+				"AMD: Verdict %s - %s (words: %d, word_duration: %d, silence_duration: %d, total_duration: %d)\n",
+				amd_verdicts[verdict].status, amd_verdicts[verdict].name,
+				hot->words, hot->current_word_duration, hot->silence_duration, hot->total_duration);
+		}
+		amd_set_result(vad, amd_verdicts[verdict].status, amd_verdicts[verdict].result);
+	}
+}
+
+/*
+ * Read and analyze one frame from the bug. Always inlined into both call
+ * sites in amd_callback, so with prof == NULL every amd_prof_mark folds away
+ * and the unprofiled path carries no profiling checks.
+ */
+static inline __attribute__((always_inline)) void amd_read_frame(amd_vad_t *vad, switch_media_bug_t *bug, amd_prof_t *prof)
+{
+	amd_vad_hot_t *hot = vad->hot;
+	uint8_t frame_data[SWITCH_RECOMMENDED_BUFFER_SIZE];
+	switch_frame_t read_frame = { 0 };
+	switch_frame_t *frame;
+	switch_codec_implementation_t read_impl = { 0 };
+
+	read_frame.data = frame_data;
+	read_frame.buflen = SWITCH_RECOMMENDED_BUFFER_SIZE;
+
+	/* Read frame from media bug - SWITCH_FALSE means non-blocking */
+	/* Process ONE frame per callback invocation - FreeSWITCH will call us for each frame */
+	if (switch_core_media_bug_read(bug, &read_frame, SWITCH_FALSE) == SWITCH_STATUS_SUCCESS) {
+		amd_prof_mark(prof, AMD_PROF_BUG_READ);
+
+		/* Check if it's a valid audio frame */
+		if (!switch_test_flag((&read_frame), SFF_CNG) &&
+		    read_frame.datalen > 0 &&
+		    read_frame.samples > 0) {
+
+			/* Get codec implementation from session */
+			/* Frames should already be in L16 format if codec was initialized */
+			switch_core_session_get_read_impl(vad->session, &read_impl);
+
+			/* If read_impl is invalid, populate it from frame info */
+			if (read_impl.actual_samples_per_second == 0) {
+				if (read_frame.rate > 0) {
+					read_impl.actual_samples_per_second = read_frame.rate;
+				} else {
+					read_impl.actual_samples_per_second = 8000; /* Default */
+				}
+			}
+			if (read_impl.number_of_channels == 0) {
+				if (read_frame.channels > 0) {
+					read_impl.number_of_channels = read_frame.channels;
+				} else {
+					read_impl.number_of_channels = 1; /* Default mono */
+				}
+			}
+
+			/* Stereo bug: channel 0 is the callee (read), channel 1 our side (write) */
+			if (hot->dual) {
+				read_impl.number_of_channels = 2;
+				read_frame.samples = read_frame.datalen / (2 * sizeof(int16_t));
+			}
+
+			/* Frame should already be in L16 format (set via switch_core_session_set_read_codec) */
+			frame = &read_frame;
+			amd_prof_mark(prof, AMD_PROF_READ_IMPL);
+
+			if (hot->debug) {
+				switch_log_printf(
+					SWITCH_CHANNEL_SESSION_LOG(vad->session),
+					SWITCH_LOG_DEBUG,
+					"AMD: Callback READ - frame=%p, samples=%d, datalen=%d, rate=%d, codec=%s\n",
+					frame, frame->samples, frame->datalen, frame->rate,
+					read_impl.iananame ? read_impl.iananame : "unknown");
+				amd_prof_mark(prof, AMD_PROF_PUBLISH);
+			}
+
+			/* Readers of the hot block (amd_list) retry while seq is odd */
+			amd_seq_begin(hot);
+			amd_process_read(vad, frame, &read_impl, prof);
+			amd_seq_end(hot);
+
+			if (prof) {
+				amd_prof_mark(prof, AMD_PROF_PUBLISH);
+				amd_prof_end(prof, vad->read_codec,
+							 vad->read_rate ? vad->read_rate : read_impl.actual_samples_per_second);
+			}
+		}
+	}
 }
 
 static switch_bool_t amd_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type)
 {
 	amd_vad_t *vad = (amd_vad_t *) user_data;
-	switch_frame_t *frame = NULL;
+	amd_vad_hot_t *hot;
 
-	if (!vad) {
+	if (!vad || !vad->hot) {
 		return SWITCH_TRUE;
 	}
+	hot = vad->hot;
 
 	/* Get session from bug and refresh channel pointer */
 	if (!vad->session && bug) {
 		vad->session = switch_core_media_bug_get_session(bug);
 	}
 
-	if (vad->complete) {
-		return SWITCH_TRUE;
-	}
-
 	if (vad->session) {
 		vad->channel = switch_core_session_get_channel(vad->session);
 	}
@@ -374,7 +1224,7 @@ static switch_bool_t amd_callback(switch_media_bug_t *bug, void *user_data, swit
 
 	switch (type) {
 	case SWITCH_ABC_TYPE_INIT:
-		if (get_debug(vad)) {
+		if (hot->debug) {
 			switch_log_printf(
 				SWITCH_CHANNEL_SESSION_LOG(vad->session),
 				SWITCH_LOG_DEBUG,
@@ -384,279 +1234,29 @@ static switch_bool_t amd_callback(switch_media_bug_t *bug, void *user_data, swit
 
 	case SWITCH_ABC_TYPE_READ:
 		/* Use switch_core_media_bug_read() to read frames from the media bug */
-		/* Only read frames when channel is ready */
-		if (!switch_channel_ready(vad->channel)) {
+		/* Only read frames when channel is ready and no verdict yet */
+		if (hot->complete || !switch_channel_ready(vad->channel)) {
 			break;
 		}
 
-		{
-			uint8_t frame_data[SWITCH_RECOMMENDED_BUFFER_SIZE];
-			switch_frame_t read_frame = { 0 };
-			switch_codec_implementation_t read_impl = { 0 };
-
-			read_frame.data = frame_data;
-			read_frame.buflen = SWITCH_RECOMMENDED_BUFFER_SIZE;
-
-			/* Read frame from media bug - SWITCH_FALSE means non-blocking */
-			/* Process ONE frame per callback invocation - FreeSWITCH will call us for each frame */
-			if (switch_core_media_bug_read(bug, &read_frame, SWITCH_FALSE) == SWITCH_STATUS_SUCCESS) {
-				/* Check if it's a valid audio frame */
-				if (!switch_test_flag((&read_frame), SFF_CNG) &&
-				    read_frame.datalen > 0 &&
-				    read_frame.samples > 0) {
-
-					/* Get codec implementation from session */
-					/* Frames should already be in L16 format if codec was initialized */
-					switch_core_session_get_read_impl(vad->session, &read_impl);
-
-					/* If read_impl is invalid, populate it from frame info */
-					if (read_impl.actual_samples_per_second == 0) {
-						if (read_frame.rate > 0) {
-							read_impl.actual_samples_per_second = read_frame.rate;
-						} else {
-							read_impl.actual_samples_per_second = 8000; /* Default */
-						}
-					}
-					if (read_impl.number_of_channels == 0) {
-						if (read_frame.channels > 0) {
-							read_impl.number_of_channels = read_frame.channels;
-						} else {
-							read_impl.number_of_channels = 1; /* Default mono */
-						}
-					}
-
-					/* Frame should already be in L16 format (set via switch_core_session_set_read_codec) */
-					frame = &read_frame;
-
-					if (get_debug(vad)) {
-						switch_log_printf(
-							SWITCH_CHANNEL_SESSION_LOG(vad->session),
-							SWITCH_LOG_DEBUG,
-							"AMD: Callback READ - frame=%p, samples=%d, datalen=%d, rate=%d, codec=%s\n",
-							frame, frame->samples, frame->datalen, frame->rate,
-							read_impl.iananame ? read_impl.iananame : "unknown");
-					}
-
-					/* Process frame immediately - calculate frame_ms and classify */
-					if (read_impl.actual_samples_per_second > 0) {
-						vad->frame_ms = 1000 / (read_impl.actual_samples_per_second / frame->samples);
-					} else if (frame->rate > 0) {
-						vad->frame_ms = 1000 / (frame->rate / frame->samples);
-					} else {
-						vad->frame_ms = 20; /* Default 20ms */
-					}
-					vad->total_duration += vad->frame_ms;
-
-					if (vad->total_duration >= get_total_analysis_time(vad)) {
-						if (get_debug(vad)) {
-							switch_log_printf(
-								SWITCH_CHANNEL_SESSION_LOG(vad->session),
-								SWITCH_LOG_DEBUG,
-								"AMD: Timeout - total_analysis_time exceeded\n");
-						}
-						switch_channel_set_variable(vad->channel, "amd_status", "unsure");
-						switch_channel_set_variable(vad->channel, "amd_result", "too-long");
-						vad->complete = SWITCH_TRUE;
-						break;
-					}
-
-					/* Classify every frame - use per-session threshold if available */
-					amd_frame_classifier frame_type = classify_frame(frame, &read_impl, get_silent_threshold(vad));
-
-					if (get_debug(vad)) {
-						switch_log_printf(
-							SWITCH_CHANNEL_SESSION_LOG(vad->session),
-							SWITCH_LOG_DEBUG,
-							"AMD: Frame processed - type=%s, total_duration=%d, intro_voice=%d, intro_words=%d, silence=%d, words=%d\n",
-							frame_type == VOICED ? "VOICED" : "SILENCE",
-							vad->total_duration,
-							vad->intro_voice_duration,
-							vad->intro_words,
-							vad->silence_duration,
-							vad->words);
-					}
-
-					if (frame_type == VOICED) {
-						if (!vad->talking) {
-							vad->talking = 1;
-							fire_custom_event(vad->session, "Start Talking");
-						}
-
-						vad->voice_duration += vad->frame_ms;
-						vad->current_word_duration += vad->frame_ms;
-						vad->silence_duration = 0;
-
-						if (vad->in_initial_silence) {
-							vad->in_initial_silence = 0;
-							vad->in_intro = 1;
-							vad->intro_voice_duration = vad->frame_ms;  /* Start counting from first voice frame */
-							vad->had_silence_break = 0;  /* Reset silence break flag */
-						} else if (vad->in_intro) {
-							/* Only increment if we haven't had a silence break */
-							if (vad->had_silence_break) {
-								/* We had silence, so this is a new voice segment - reset intro tracking */
-								vad->intro_voice_duration = vad->frame_ms;
-								vad->had_silence_break = 0;  /* Reset flag for new voice segment */
-							} else {
-								/* Continuous voice - increment */
-								vad->intro_voice_duration += vad->frame_ms;
-							}
-						}
-
-						/* Exit intro period when we've passed the intro time window */
-						if (vad->in_intro && vad->total_duration >= get_noise_max_intro(vad)) {
-							vad->in_intro = 0;
-							vad->max_intro_checked = 1;
-						}
-
-						/* Count word when transitioning from silence to voice (silence -> voice) */
-						/* Word is counted when we have enough voice duration after silence */
-						if (vad->current_word_duration >= get_noise_min_length(vad) && !vad->word_counted) {
-							/* We have enough voice to count as a word - count it now (silence -> voice transition) */
-							vad->words++;  /* Total word count (throughout detection) */
-
-							/* Also count to intro_words if we're still in intro period */
-							if (vad->total_duration < get_noise_max_intro(vad)) {
-								vad->intro_words++;
-							}
-
-							if (get_debug(vad)) {
-								switch_log_printf(
-									SWITCH_CHANNEL_SESSION_LOG(vad->session),
-									SWITCH_LOG_DEBUG,
-									"AMD: Word detected (silence->voice transition) - words: %d, intro_words: %d, word_duration: %d, total_duration: %d\n",
-									vad->words, vad->intro_words, vad->current_word_duration, vad->total_duration);
-							}
-
-							vad->word_counted = 1;
-							vad->state = VAD_STATE_IN_WORD;
-							vad->last_noise_start = vad->total_duration;
-						}
-
-						/* Check for machine detection based on max-intro logic */
-						/* During intro period, check if the first word's length (duration) >= noise_max_intro */
-						/* Only check once for the first word, and only during intro period */
-						if (!vad->max_intro_checked && vad->words == 1 && vad->in_intro && vad->current_word_duration >= get_noise_max_intro(vad)) {
-							if (get_debug(vad)) {
-								switch_log_printf(
-									SWITCH_CHANNEL_SESSION_LOG(vad->session),
-									SWITCH_LOG_DEBUG,
-									"AMD: Machine detected - max-intro (first word duration: %d, max_intro: %d, total_duration: %d)\n",
-									vad->current_word_duration, get_noise_max_intro(vad), vad->total_duration);
-							}
-							switch_channel_set_variable(vad->channel, "amd_status", "machine");
-							switch_channel_set_variable(vad->channel, "amd_result", "max-intro");
-							vad->max_intro_checked = 1;
-							vad->complete = SWITCH_TRUE;
-							break;
-						}
-
-						/* Check for machine detection based on max-count logic */
-						/* If total word count reaches noise_max_count at any time (including during intro), detect as machine */
-						if (vad->words >= get_noise_max_count(vad)) {
-							if (get_debug(vad)) {
-								switch_log_printf(
-									SWITCH_CHANNEL_SESSION_LOG(vad->session),
-									SWITCH_LOG_DEBUG,
-									"AMD: Machine detected - max-count (words: %d, max: %d, total_duration: %d)\n",
-									vad->words, get_noise_max_count(vad), vad->total_duration);
-							}
-							switch_channel_set_variable(vad->channel, "amd_status", "machine");
-							switch_channel_set_variable(vad->channel, "amd_result", "max-count");
-							vad->complete = SWITCH_TRUE;
-							break;
-						}
-
-						vad->last_noise_end = vad->total_duration;
-					} else {
-					if (vad->talking) {
-						vad->talking = 0;
-						fire_custom_event(vad->session, "Stop Talking");
-					}
-
-					vad->silence_duration += vad->frame_ms;
-					vad->voice_duration = 0;
-
-					/* Check if intro period has ended during silence */
-					if (vad->in_intro && vad->total_duration >= get_noise_max_intro(vad)) {
-						vad->in_intro = 0;
-						vad->max_intro_checked = 1;
-					}
-
-					/* When silence is detected during intro, mark that we had a silence break */
-					/* This ensures max-intro only counts continuous voice, not voice with breaks */
-					if (vad->in_intro) {
-						if (vad->silence_duration >= get_noise_inter_silence(vad)) {
-							/* Word break detected - mark that we had silence */
-							/* This will prevent max-intro from triggering on non-continuous voice */
-							vad->had_silence_break = 1;
-							vad->intro_voice_duration = 0;  /* Reset since we had a break */
-						}
-					}
-
-					/* When we have silence >= noise_inter_silence, it's a word break */
-					/* Reset word tracking for next potential word */
-					if (vad->silence_duration >= get_noise_inter_silence(vad)) {
-						vad->state = VAD_STATE_IN_SILENCE;
-						/* Reset word duration and counting flag for next word */
-						vad->current_word_duration = 0;
-						vad->word_counted = 0;
-					}
-
-					if (vad->in_initial_silence && vad->silence_duration >= get_silent_initial(vad)) {
-						if (get_debug(vad)) {
-							switch_log_printf(
-								SWITCH_CHANNEL_SESSION_LOG(vad->session),
-								SWITCH_LOG_DEBUG,
-								"AMD: Person detected - silent-initial (silence_duration: %d)\n",
-								vad->silence_duration);
-						}
-						switch_channel_set_variable(vad->channel, "amd_status", "person");
-						switch_channel_set_variable(vad->channel, "amd_result", "silent-initial");
-						vad->complete = SWITCH_TRUE;
-						break;
-					}
-
-					/* Check for person detection based on silent-after-intro logic */
-					/* After the first word ends, check if silence length >= silent_after_intro */
-					/* Only check once after the first word ends */
-					if (!vad->silent_after_intro_checked && vad->words == 1 && vad->silence_duration >= get_silent_after_intro(vad)) {
-						if (get_debug(vad)) {
-							switch_log_printf(
-								SWITCH_CHANNEL_SESSION_LOG(vad->session),
-								SWITCH_LOG_DEBUG,
-								"AMD: Person detected - silent-after-intro (silence_duration: %d, after first word)\n",
-								vad->silence_duration);
-						}
-						switch_channel_set_variable(vad->channel, "amd_status", "person");
-						switch_channel_set_variable(vad->channel, "amd_result", "silent-after-intro");
-						vad->silent_after_intro_checked = 1;
-						vad->complete = SWITCH_TRUE;
-						break;
-					}
-
-						if (vad->silence_duration >= get_silent_max_session(vad) && vad->words > 0) {
-							if (get_debug(vad)) {
-								switch_log_printf(
-									SWITCH_CHANNEL_SESSION_LOG(vad->session),
-									SWITCH_LOG_DEBUG,
-									"AMD: Person detected - silent_max_session reached\n");
-							}
-							switch_channel_set_variable(vad->channel, "amd_status", "person");
-							switch_channel_set_variable(vad->channel, "amd_result", "silent-after-intro");
-							vad->complete = SWITCH_TRUE;
-							break;
-						}
-					}
-				}
-			}
+		/* One predictable branch when profiling is off; the NULL copy has no profiling code */
+		if (__builtin_expect(__atomic_load_n(&profile_enabled, __ATOMIC_RELAXED), 0)) {
+			amd_prof_t prof;
+
+			memset(&prof, 0, sizeof(prof));
+			prof.last = amd_prof_ticks();
+			amd_read_frame(vad, bug, &prof);
+		} else {
+			amd_read_frame(vad, bug, NULL);
 		}
 		break;
 
 	case SWITCH_ABC_TYPE_CLOSE:
 		/* Cleanup on bug removal */
 		if (vad) {
-			if (get_debug(vad)) {
+			vad->engine->finish(hot, vad->engine_state);
+			model_publish_metrics(vad);
+			if (hot->debug) {
 				switch_log_printf(
 					SWITCH_CHANNEL_SESSION_LOG(vad->session),
 					SWITCH_LOG_DEBUG,
@@ -674,6 +1274,10 @@ static switch_bool_t amd_callback(switch_media_bug_t *bug, void *user_data, swit
 					switch_mutex_unlock(bug_hash_mutex);
 				}
 			}
+			amd_release(hot);
+			amd_prof_flush();
+			__atomic_store_n(&vad->hot, NULL, __ATOMIC_RELEASE);
+			hot_free(hot);
 		}
 		break;
 
@@ -685,74 +1289,6 @@ static switch_bool_t amd_callback(switch_media_bug_t *bug, void *user_data, swit
 }
 
 
-static void parse_amd_params(amd_vad_t *vad, const char *data)
-{
-	char *data_copy = NULL;
-	char *p, *key, *val, *next;
-
-	if (!data || !strlen(data)) {
-		return;
-	}
-
-	data_copy = strdup(data);
-	p = data_copy;
-
-	while (p && *p) {
-		/* Find the next comma or end of string */
-		next = strchr(p, ',');
-		if (next) {
-			*next++ = '\0';
-		}
-
-		/* Find the equals sign */
-		val = strchr(p, '=');
-		if (val) {
-			*val++ = '\0';
-			key = p;
-
-			/* Trim whitespace from key */
-			while (*key == ' ' || *key == '\t' || *key == '\n' || *key == '\r') key++;
-			{
-				char *end = key + strlen(key) - 1;
-				while (end > key && (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r')) *end-- = '\0';
-			}
-
-			/* Trim whitespace from val */
-			while (*val == ' ' || *val == '\t' || *val == '\n' || *val == '\r') val++;
-			{
-				char *end = val + strlen(val) - 1;
-				while (end > val && (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r')) *end-- = '\0';
-			}
-
-			if (!strcasecmp(key, "silent_threshold")) {
-				vad->silent_threshold = atoi(val);
-			} else if (!strcasecmp(key, "silent_initial")) {
-				vad->silent_initial = atoi(val);
-			} else if (!strcasecmp(key, "silent_after_intro")) {
-				vad->silent_after_intro = atoi(val);
-			} else if (!strcasecmp(key, "silent_max_session")) {
-				vad->silent_max_session = atoi(val);
-			} else if (!strcasecmp(key, "noise_max_intro")) {
-				vad->noise_max_intro = atoi(val);
-			} else if (!strcasecmp(key, "noise_min_length")) {
-				vad->noise_min_length = atoi(val);
-			} else if (!strcasecmp(key, "noise_inter_silence")) {
-				vad->noise_inter_silence = atoi(val);
-			} else if (!strcasecmp(key, "noise_max_count")) {
-				vad->noise_max_count = atoi(val);
-			} else if (!strcasecmp(key, "total_analysis_time")) {
-				vad->total_analysis_time = atoi(val);
-			} else if (!strcasecmp(key, "debug")) {
-				vad->debug = atoi(val);
-			}
-		}
-
-		p = next;
-	}
-
-	free(data_copy);
-}
-
 SWITCH_STANDARD_APP(voice_start_function)
 {
 	switch_channel_t *channel = switch_core_session_get_channel(session);
@@ -764,33 +1300,66 @@ SWITCH_STANDARD_APP(voice_start_function)
 		return;
 	}
 
+	/* Over max_sessions: no detector, the call falls through as unsure */
+	if (!amd_admit()) {
+		switch_log_printf(
+			SWITCH_CHANNEL_SESSION_LOG(session),
+			SWITCH_LOG_WARNING,
+			"AMD: max_sessions (%u) reached, detection not started\n", globals.max_sessions);
+		switch_channel_set_variable(channel, "amd_status", "unsure");
+		switch_channel_set_variable(channel, "amd_result", "overload");
+		return;
+	}
+
 	vad = (amd_vad_t *) switch_core_session_alloc(session, sizeof(amd_vad_t));
 	memset(vad, 0, sizeof(amd_vad_t));
 
 	vad->session = session;
 	vad->channel = channel;
-	vad->state = VAD_STATE_IN_SILENCE;
-	vad->in_initial_silence = 1;
-	vad->in_intro = 0;
-	vad->complete = 0;
-	vad->talking = 0;
-	vad->current_word_duration = 0;
-	vad->word_counted = 0;
-	vad->had_silence_break = 0;
-	vad->intro_words = 0;
-	vad->words = 0;
+	switch_mutex_init(&vad->wait_mutex, SWITCH_MUTEX_NESTED, switch_core_session_get_pool(session));
 
 	/* Parse per-session parameters if provided */
 	if (data && strlen(data)) {
-		parse_amd_params(vad, data);
+		amd_params_parse(&vad->params, data, vad);
 	}
 
+	vad->hot = hot_alloc();
+	vad->hot->state = AMD_SM_INITIAL_SILENCE;
+	vad->hot->owner = vad;
+	resolve_params(vad);
+
+	/* Resolve the detection engine: per-session, then amd.conf.xml, then energy */
+	vad->engine = vad->params.engine;
+	if (!vad->engine) {
+		vad->engine = amd_find_engine(globals.engine);
+	}
+	if (!vad->engine) {
+		vad->engine = &amd_energy_engine;
+	}
+	if (vad->engine->footprint() > 0) {
+		vad->engine_state = switch_core_session_alloc(session, vad->engine->footprint());
+		memset(vad->engine_state, 0, vad->engine->footprint());
+	}
+	if (vad->engine->init(vad->hot, vad->engine_state)) {
+		switch_log_printf(
+			SWITCH_CHANNEL_SESSION_LOG(session),
+			SWITCH_LOG_WARNING,
+			"AMD: Failed to initialize engine %s, falling back to energy\n", vad->engine->name);
+		vad->engine = &amd_energy_engine;
+		vad->engine->init(vad->hot, vad->engine_state);
+	}
+	switch_channel_set_variable(channel, "amd_engine", vad->engine->name);
+
 	/* Initialize L16 codec for receiving decoded frames */
 	/* We create a new L16 (raw 16-bit samples) codec for the read end */
 	/* This ensures we always receive frames in L16 format, regardless of the channel's codec */
 	switch_codec_implementation_t read_impl = { 0 };
 	switch_core_session_get_read_impl(session, &read_impl);
 
+	/* Remember what the channel really reads; after the swap every frame looks like L16 */
+	switch_copy_string(vad->read_codec, read_impl.iananame ? read_impl.iananame : "unknown", sizeof(vad->read_codec));
+	vad->read_rate = read_impl.actual_samples_per_second;
+
 	if (read_impl.actual_samples_per_second > 0) {
 		status = switch_core_codec_init(
 			&vad->raw_codec,
@@ -817,15 +1386,22 @@ SWITCH_STANDARD_APP(voice_start_function)
 	}
 
 	/* Media bug operations handle session locking internally */
-	/* Use SMBF_READ_STREAM to get frames in callback */
+	/* Use SMBF_READ_STREAM to get frames in callback; in dual mode also the write stream, as stereo */
 	/* Frames will be in L16 format if codec was initialized successfully */
-	status = switch_core_media_bug_add(session, "amd", NULL, amd_callback, vad, 0, SMBF_READ_STREAM, &bug);
+	status = switch_core_media_bug_add(
+		session, "amd", NULL, amd_callback, vad, 0,
+		vad->hot->dual ? (SMBF_READ_STREAM | SMBF_WRITE_STREAM | SMBF_STEREO) : SMBF_READ_STREAM,
+		&bug);
 
 	if (status != SWITCH_STATUS_SUCCESS) {
 		switch_log_printf(
 			SWITCH_CHANNEL_SESSION_LOG(session),
 			SWITCH_LOG_ERROR,
 			"Failed to add media bug\n");
+		vad->engine->finish(vad->hot, vad->engine_state);
+		amd_release(vad->hot);
+		hot_free(vad->hot);
+		vad->hot = NULL;
 		return;
 	}
 
@@ -845,7 +1421,7 @@ SWITCH_STANDARD_APP(voice_start_function)
 
 	fire_media_bug_event(session, "SWITCH_MEDIA_BUG_ADD");
 
-	if (get_debug(vad)) {
+	if (vad->hot->debug) {
 		switch_log_printf(
 			SWITCH_CHANNEL_SESSION_LOG(session),
 			SWITCH_LOG_DEBUG,
@@ -894,6 +1470,62 @@ SWITCH_STANDARD_APP(voice_stop_function)
 	}
 }
 
+/* Playback input callback for waitforresult: stop on the detector's result event */
+static switch_bool_t is_result_event(switch_event_t *event)
+{
+	const char *subclass = switch_event_get_header(event, "Event-Subclass");
+	const char *action = switch_event_get_header(event, "Action");
+
+	return subclass && !strcmp(subclass, "AMD::EVENT") && action && !strcmp(action, "Result");
+}
+
+/* buf is the session's amd_vad_t */
+static switch_status_t waitforresult_input_callback(switch_core_session_t *session, void *input, switch_input_type_t input_type, void *buf, unsigned int buflen)
+{
+	amd_vad_t *vad = (amd_vad_t *) buf;
+
+	if (input_type == SWITCH_INPUT_TYPE_EVENT && is_result_event((switch_event_t *) input)) {
+		switch_mutex_lock(vad->wait_mutex);
+		vad->result_queued = 0;
+		switch_mutex_unlock(vad->wait_mutex);
+		return SWITCH_STATUS_BREAK;
+	}
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * A verdict that lands after the prompt stopped reading events, but before
+ * waiting was cleared, leaves its Result event queued. Drop it so the next
+ * application does not receive it; other queued events keep their order.
+ */
+static void waitforresult_drain(amd_vad_t *vad)
+{
+	switch_event_t *event;
+	uint32_t count;
+
+	switch_mutex_lock(vad->wait_mutex);
+	vad->waiting = 0;
+	if (!vad->result_queued) {
+		switch_mutex_unlock(vad->wait_mutex);
+		return;
+	}
+	vad->result_queued = 0;
+	switch_mutex_unlock(vad->wait_mutex);
+
+	/* Rotate the queue once, dropping Result events */
+	for (count = switch_core_session_event_count(vad->session); count; count--) {
+		if (switch_core_session_dequeue_event(vad->session, &event, SWITCH_TRUE) != SWITCH_STATUS_SUCCESS) {
+			break;
+		}
+		if (is_result_event(event)) {
+			switch_event_destroy(&event);
+		} else {
+			switch_core_session_queue_event(vad->session, &event);
+		}
+	}
+}
+
 SWITCH_STANDARD_APP(waitforresult_function)
 {
 	switch_channel_t *channel = switch_core_session_get_channel(session);
@@ -920,6 +1552,28 @@ SWITCH_STANDARD_APP(waitforresult_function)
 		return;
 	}
 
+	/* Play the given file until it ends or the detector reaches a verdict */
+	if (data && strlen(data)) {
+		amd_vad_t *vad = (amd_vad_t *) switch_core_media_bug_get_user_data(bug);
+
+		if (vad) {
+			switch_mutex_lock(vad->wait_mutex);
+			vad->waiting = 1;
+			switch_mutex_unlock(vad->wait_mutex);
+
+			var = switch_channel_get_variable(channel, "amd_status");
+			if (!var || !strlen(var)) {
+				switch_input_args_t args = { 0 };
+
+				args.input_callback = waitforresult_input_callback;
+				args.buf = vad;
+				switch_ivr_play_file(session, NULL, data, &args);
+			}
+
+			waitforresult_drain(vad);
+		}
+	}
+
 	while (switch_channel_ready(channel) && bug) {
 		var = switch_channel_get_variable(channel, "amd_status");
 		if (var && strlen(var)) {
@@ -953,3 +1607,350 @@ SWITCH_STANDARD_APP(waitforresult_function)
 		}
 	}
 }
+
+SWITCH_STANDARD_API(amd_stats_function)
+{
+	uint32_t slabs, in_use, peak;
+	int i;
+
+	switch_mutex_lock(hot_slab.mutex);
+	slabs = hot_slab.slabs;
+	in_use = hot_slab.in_use;
+	peak = hot_slab.peak;
+	switch_mutex_unlock(hot_slab.mutex);
+
+	stream->write_function(stream, "hot_block_bytes: %u\n", (uint32_t) sizeof(amd_vad_hot_t));
+	stream->write_function(stream, "hot_slabs: %u\n", slabs);
+	stream->write_function(stream, "hot_blocks_in_use: %u\n", in_use);
+	stream->write_function(stream, "hot_blocks_peak: %u\n", peak);
+	stream->write_function(stream, "hot_footprint_bytes: %u\n", (uint32_t) (slabs * (AMD_SLAB_BLOCKS * sizeof(amd_vad_hot_t) + 64)));
+	stream->write_function(stream, "session_context_bytes: %u\n", (uint32_t) sizeof(amd_vad_t));
+	for (i = 0; amd_engines[i]; i++) {
+		stream->write_function(stream, "engine_%s_state_bytes: %u\n", amd_engines[i]->name, (uint32_t) amd_engines[i]->footprint());
+	}
+	stream->write_function(stream, "sessions_active: %u\n", __atomic_load_n(&load.active, __ATOMIC_RELAXED));
+	stream->write_function(stream, "sessions_peak: %u\n", __atomic_load_n(&load.peak, __ATOMIC_RELAXED));
+	stream->write_function(stream, "sessions_started: %" PRIu64 "\n", __atomic_load_n(&load.started, __ATOMIC_RELAXED));
+	stream->write_function(stream, "sessions_rejected: %" PRIu64 "\n", __atomic_load_n(&load.rejected, __ATOMIC_RELAXED));
+	stream->write_function(stream, "frames: %" PRIu64 "\n", __atomic_load_n(&load.frames, __ATOMIC_RELAXED));
+	stream->write_function(stream, "frames_skipped: %" PRIu64 "\n", __atomic_load_n(&load.skipped_frames, __ATOMIC_RELAXED));
+	stream->write_function(stream, "frame_cost_ns: %" PRIu64 "\n", __atomic_load_n(&load.frame_ns, __ATOMIC_RELAXED));
+	stream->write_function(stream, "dual_frame_cost_ns: %" PRIu64 "\n", __atomic_load_n(&load.dual_frame_ns, __ATOMIC_RELAXED));
+	stream->write_function(stream, "degraded: %s\n", amd_degraded() ? "true" : "false");
+	{
+		uint64_t n = __atomic_load_n(&load.decisions, __ATOMIC_RELAXED);
+		uint64_t dual_n = __atomic_load_n(&load.dual_decisions, __ATOMIC_RELAXED);
+
+		stream->write_function(stream, "decision_ms_avg: %" PRIu64 "\n", n ? __atomic_load_n(&load.decision_ms, __ATOMIC_RELAXED) / n : 0);
+		stream->write_function(stream, "dual_decision_ms_avg: %" PRIu64 "\n", dual_n ? __atomic_load_n(&load.dual_decision_ms, __ATOMIC_RELAXED) / dual_n : 0);
+	}
+	stream->write_function(stream, "fingerprint_cache_entries: %u\n", fp_cache.entries ? fp_cache.mask + 1 : 0);
+	stream->write_function(stream, "fingerprint_lookups: %" PRIu64 "\n", __atomic_load_n(&fp_cache.lookups, __ATOMIC_RELAXED));
+	stream->write_function(stream, "fingerprint_hits: %" PRIu64 "\n", __atomic_load_n(&fp_cache.hits, __ATOMIC_RELAXED));
+	stream->write_function(stream, "fingerprint_inserts: %" PRIu64 "\n", __atomic_load_n(&fp_cache.inserts, __ATOMIC_RELAXED));
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/* Consistent copy of a live hot block, taken without the media thread's cooperation */
+typedef struct {
+	uint32_t total_duration;
+	uint32_t silence_duration;
+	uint32_t voice_duration;
+	uint32_t current_word_duration;
+	uint32_t words;
+	uint32_t intro_words;
+	uint32_t frames;
+	uint32_t skipped_frames;
+	amd_vad_state_t state;
+	uint32_t complete;
+	uint32_t dual;
+} amd_snapshot_t;
+
+#define AMD_SNAPSHOT_TRIES 64
+
+static switch_bool_t amd_snapshot(amd_vad_t *vad, amd_snapshot_t *snap)
+{
+	amd_vad_hot_t *hot = __atomic_load_n(&vad->hot, __ATOMIC_ACQUIRE);
+	const void *owner;
+	uint32_t seq;
+	int i;
+
+	for (i = 0; hot && i < AMD_SNAPSHOT_TRIES; i++) {
+		seq = __atomic_load_n(&hot->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			switch_cond_next();
+			continue;
+		}
+
+		snap->total_duration = hot->total_duration;
+		snap->silence_duration = hot->silence_duration;
+		snap->voice_duration = hot->voice_duration;
+		snap->current_word_duration = hot->current_word_duration;
+		snap->words = hot->words;
+		snap->intro_words = hot->intro_words;
+		snap->frames = hot->frames;
+		snap->skipped_frames = hot->skipped_frames;
+		snap->state = hot->state;
+		snap->complete = hot->complete;
+		snap->dual = hot->dual;
+		owner = hot->owner;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&hot->seq, __ATOMIC_RELAXED) == seq) {
+			return owner == vad && snap->state < AMD_SM_STATES ? SWITCH_TRUE : SWITCH_FALSE;
+		}
+	}
+
+	return SWITCH_FALSE;
+}
+
+/* Describe the detection on uuid, NULL if it has none (or it ended meanwhile) */
+static cJSON *amd_status_json(const char *uuid)
+{
+	switch_core_session_t *session;
+	switch_media_bug_t *bug;
+	amd_vad_t *vad = NULL;
+	amd_snapshot_t snap;
+	cJSON *json = NULL;
+
+	if (!(session = switch_core_session_locate(uuid))) {
+		return NULL;
+	}
+
+	/* Holding the registry mutex keeps CLOSE, and so the bug, from going away */
+	switch_mutex_lock(bug_hash_mutex);
+	if ((bug = (switch_media_bug_t *) switch_core_hash_find(bug_hash, uuid))) {
+		vad = (amd_vad_t *) switch_core_media_bug_get_user_data(bug);
+	}
+	switch_mutex_unlock(bug_hash_mutex);
+
+	if (vad && amd_snapshot(vad, &snap)) {
+		switch_channel_t *channel = switch_core_session_get_channel(session);
+		const char *status = switch_channel_get_variable(channel, "amd_status");
+		const char *result = switch_channel_get_variable(channel, "amd_result");
+
+		json = cJSON_CreateObject();
+		cJSON_AddStringToObject(json, "uuid", uuid);
+		cJSON_AddStringToObject(json, "engine", vad->engine->name);
+		cJSON_AddItemToObject(json, "dual", snap.dual ? cJSON_CreateTrue() : cJSON_CreateFalse());
+		cJSON_AddStringToObject(json, "state", amd_sm_state_names[snap.state]);
+		cJSON_AddItemToObject(json, "in_intro",
+			amd_sm_in_intro(snap.state) ? cJSON_CreateTrue() : cJSON_CreateFalse());
+		cJSON_AddNumberToObject(json, "elapsed_ms", snap.total_duration);
+		cJSON_AddNumberToObject(json, "words", snap.words);
+		cJSON_AddNumberToObject(json, "intro_words", snap.intro_words);
+		cJSON_AddNumberToObject(json, "silence_ms", snap.silence_duration);
+		cJSON_AddNumberToObject(json, "voice_ms", snap.voice_duration);
+		cJSON_AddNumberToObject(json, "word_ms", snap.current_word_duration);
+		cJSON_AddNumberToObject(json, "frames", snap.frames);
+		cJSON_AddNumberToObject(json, "frames_skipped", snap.skipped_frames);
+		cJSON_AddItemToObject(json, "complete", snap.complete ? cJSON_CreateTrue() : cJSON_CreateFalse());
+		cJSON_AddStringToObject(json, "status", status ? status : "");
+		cJSON_AddStringToObject(json, "result", result ? result : "");
+	}
+
+	switch_core_session_rwunlock(session);
+	return json;
+}
+
+SWITCH_STANDARD_API(amd_list_function)
+{
+	switch_hash_index_t *hi;
+	cJSON *uuids = cJSON_CreateArray();
+	cJSON *list = cJSON_CreateArray();
+	cJSON *item;
+	char *out;
+	int i;
+
+	/* Copy the uuids so no session lock is taken under the registry mutex */
+	switch_mutex_lock(bug_hash_mutex);
+	for (hi = switch_core_hash_first(bug_hash); hi; hi = switch_core_hash_next(&hi)) {
+		const void *key;
+		void *val;
+
+		switch_core_hash_this(hi, &key, NULL, &val);
+		cJSON_AddItemToArray(uuids, cJSON_CreateString((const char *) key));
+	}
+	switch_mutex_unlock(bug_hash_mutex);
+
+	for (i = 0; i < cJSON_GetArraySize(uuids); i++) {
+		if ((item = amd_status_json(cJSON_GetArrayItem(uuids, i)->valuestring))) {
+			cJSON_AddItemToArray(list, item);
+		}
+	}
+	cJSON_Delete(uuids);
+
+	out = cJSON_PrintUnformatted(list);
+	stream->write_function(stream, "%s\n", out);
+	switch_safe_free(out);
+	cJSON_Delete(list);
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+SWITCH_STANDARD_API(amd_status_function)
+{
+	cJSON *json;
+	char *out;
+
+	if (zstr(cmd)) {
+		stream->write_function(stream, "-USAGE: amd_status <uuid>\n");
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	if (!(json = amd_status_json(cmd))) {
+		stream->write_function(stream, "-ERR No active AMD on %s\n", cmd);
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	out = cJSON_PrintUnformatted(json);
+	stream->write_function(stream, "%s\n", out);
+	switch_safe_free(out);
+	cJSON_Delete(json);
+
+	return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * Ticks of amd_prof_ticks() per microsecond, measured against the monotonic
+ * clock. Sleeps 20ms on x86, so never call it with profile.mutex held.
+ */
+static uint64_t amd_prof_calibrate(const char **clock)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint64_t ns = amd_now_ns(), ticks = amd_prof_ticks();
+
+	switch_yield(20000);
+	ns = amd_now_ns() - ns;
+	ticks = amd_prof_ticks() - ticks;
+
+	*clock = "tsc";
+	return ns ? (ticks * 1000 + ns / 2) / ns : 1000;
+#else
+	*clock = "clock_gettime";
+	return 1000;
+#endif
+}
+
+/* Caller holds profile.mutex */
+static void amd_prof_reset(void)
+{
+	__atomic_add_fetch(&profile.generation, 1, __ATOMIC_RELAXED);
+	profile.buckets_used = 0;
+	memset(profile.buckets, 0, sizeof(profile.buckets));
+	profile.started = switch_micro_time_now();
+	profile.stopped = 0;
+}
+
+/* Mean ns per frame of each stage, and the total */
+static void amd_prof_write_stages(switch_stream_handle_t *stream, const uint64_t *ticks, uint64_t frames)
+{
+	uint64_t total = 0;
+	int i;
+
+	for (i = 0; i < AMD_PROF_STAGES; i++) {
+		stream->write_function(stream, " %s=%" PRIu64, amd_prof_stage_names[i], ticks[i] * 1000 / profile.ticks_per_us / frames);
+		total += ticks[i];
+	}
+	stream->write_function(stream, " total=%" PRIu64 "\n", total * 1000 / profile.ticks_per_us / frames);
+}
+
+SWITCH_STANDARD_API(amd_profile_function)
+{
+	amd_prof_bucket_t buckets[AMD_PROF_BUCKETS], all = { { 0 } };
+	switch_time_t started, stopped;
+	uint64_t total = 0, wall_us;
+	uint32_t used, i;
+	int s;
+
+	if (!zstr(cmd) && strcasecmp(cmd, "on") && strcasecmp(cmd, "off") && strcasecmp(cmd, "reset")) {
+		stream->write_function(stream, "-USAGE: amd_profile [on|off|reset]\n");
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	if (!zstr(cmd)) {
+		uint64_t ticks_per_us = 0;
+		const char *clock = NULL;
+
+		/* Calibrate before taking the lock: media threads flush under it */
+		if ((!strcasecmp(cmd, "on") && !__atomic_load_n(&profile_enabled, __ATOMIC_RELAXED)) ||
+			(!strcasecmp(cmd, "reset") && !profile.ticks_per_us)) {
+			ticks_per_us = amd_prof_calibrate(&clock);
+		}
+
+		switch_mutex_lock(profile.mutex);
+		if (!strcasecmp(cmd, "on")) {
+			if (!__atomic_load_n(&profile_enabled, __ATOMIC_RELAXED) && ticks_per_us) {
+				profile.ticks_per_us = ticks_per_us;
+				profile.clock = clock;
+				amd_prof_reset();
+				__atomic_store_n(&profile_enabled, 1, __ATOMIC_RELAXED);
+			}
+		} else if (!strcasecmp(cmd, "off")) {
+			if (__atomic_load_n(&profile_enabled, __ATOMIC_RELAXED)) {
+				__atomic_store_n(&profile_enabled, 0, __ATOMIC_RELAXED);
+				profile.stopped = switch_micro_time_now();
+			}
+		} else {
+			if (!profile.ticks_per_us) {
+				profile.ticks_per_us = ticks_per_us;
+				profile.clock = clock;
+			}
+			amd_prof_reset();
+			if (!__atomic_load_n(&profile_enabled, __ATOMIC_RELAXED)) {
+				profile.stopped = profile.started;
+			}
+		}
+		switch_mutex_unlock(profile.mutex);
+		stream->write_function(stream, "+OK profiling %s\n", __atomic_load_n(&profile_enabled, __ATOMIC_RELAXED) ? "on" : "off");
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	switch_mutex_lock(profile.mutex);
+	used = profile.buckets_used;
+	memcpy(buckets, profile.buckets, sizeof(buckets));
+	started = profile.started;
+	stopped = profile.stopped;
+	switch_mutex_unlock(profile.mutex);
+
+	stream->write_function(stream, "profiling: %s\n", __atomic_load_n(&profile_enabled, __ATOMIC_RELAXED) ? "on" : "off");
+	if (!started) {
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	for (i = 0; i < used; i++) {
+		all.frames += buckets[i].frames;
+		for (s = 0; s < AMD_PROF_STAGES; s++) {
+			all.ticks[s] += buckets[i].ticks[s];
+			total += buckets[i].ticks[s];
+		}
+	}
+	wall_us = (uint64_t) ((stopped ? stopped : switch_micro_time_now()) - started);
+
+	stream->write_function(stream, "clock: %s\n", profile.clock);
+	stream->write_function(stream, "ticks_per_us: %" PRIu64 "\n", profile.ticks_per_us);
+	stream->write_function(stream, "elapsed_ms: %" PRIu64 "\n", wall_us / 1000);
+	stream->write_function(stream, "frames: %" PRIu64 "\n", all.frames);
+
+	/* Share of one core spent in the READ path while profiling */
+	stream->write_function(stream, "cpu_percent: %.3f\n", wall_us ? (double) total / profile.ticks_per_us * 100 / wall_us : 0.0);
+	if (!all.frames) {
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	stream->write_function(stream, "stage_ns:");
+	amd_prof_write_stages(stream, all.ticks, all.frames);
+	stream->write_function(stream, "stage_percent:");
+	for (s = 0; s < AMD_PROF_STAGES; s++) {
+		stream->write_function(stream, " %s=%.1f", amd_prof_stage_names[s], total ? (double) all.ticks[s] * 100 / total : 0.0);
+	}
+	stream->write_function(stream, "\n");
+
+	for (i = 0; i < used; i++) {
+		stream->write_function(stream, "codec %s/%u: frames=%" PRIu64, buckets[i].codec, buckets[i].rate, buckets[i].frames);
+		amd_prof_write_stages(stream, buckets[i].ticks, buckets[i].frames);
+	}
+
+	return SWITCH_STATUS_SUCCESS;
+}
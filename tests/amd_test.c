@@ -0,0 +1,1498 @@
+/*
+ * amd_test -- golden verdicts and performance baseline for amd_core
+ *
+ *   amd_test gen <corpus> <dir>
+ *   amd_test check [-m model] <corpus> <dir>
+ *   amd_test bench [-m model] [-t tolerance] [-u] <corpus> <dir> <expect> <baseline>
+ *   amd_test compare [-m model] <corpus> <dir>
+ *
+ * The corpus file lists one recording per line: name, format, voice_start
+ * params, the expected amd_status and amd_result, and the audio. Audio is
+ * either synthesized from segments (gen writes <dir>/<name>.wav from a
+ * fixed seed, so the files are the same on every run) or a recording
+ * committed next to the corpus file, given as @path.
+ *
+ * check runs every file through amd_tool_run and compares the verdict,
+ * then checks which synthetic openings give a usable greeting fingerprint
+ * and replays random calls through amd_sm_step and the branch tree it
+ * replaced, which must agree frame by frame.
+ * bench times each engine over the corpus, the state machine alone, the
+ * branch tree it replaced, and 10k interleaved sessions. The mean decision
+ * time of each engine is deterministic and must match the expectations
+ * file exactly. ns/frame is also reported as a ratio to a calibration
+ * kernel timed in the same run, the median of BENCH_ROUNDS interleaved
+ * rounds, and compared with this machine's baseline file (written by the
+ * first run, or with -u). Timings only fail the run when a tolerance is
+ * given and a ratio is more than tolerance percent above the baseline;
+ * without one they are report-only.
+ *
+ * compare runs every engine over every file, regardless of the engine the
+ * corpus line selects, and reports each engine's verdicts, its accuracy
+ * against the expected amd_status, mean decision time and ns/frame.
+ */
+#include "amd_tool.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define TEST_FRAME_MS 20
+#define TEST_MAX_CASES 256
+#define BENCH_REPS 15
+#define BENCH_ROUNDS 15
+#define BENCH_MAX_ROWS 8
+#define BENCH_LOOPS 20
+#define BENCH_SM_LOOPS 400
+#define BENCH_SESSIONS 10000
+#define BENCH_TICKS 40
+#define CALIB_SAMPLES 160
+#define CALIB_LOOPS 20000
+
+typedef struct {
+	char name[64];
+	char path[PATH_MAX];
+	char params[256];
+	char status[16];
+	char result[32];
+	char audio[1024];
+	amd_tool_encoding_t encoding;
+	uint32_t rate;
+	uint32_t channels;
+	amd_params_t p;
+} test_case_t;
+
+static test_case_t cases[TEST_MAX_CASES];
+static int ncases;
+
+/* One line of the bench table */
+typedef struct {
+	const char *name;
+	double ns_per_frame;
+	double ratio;  /* ns_per_frame over the calibration kernel's ns per pass */
+	double decision_ms;  /* < 0 where it does not apply */
+	double misses_per_frame;  /* < 0 if unavailable */
+} bench_row_t;
+
+/*
+ * Corpus
+ */
+
+static int parse_format(const char *s, test_case_t *c)
+{
+	char enc[16];
+
+	c->channels = 1;
+	if (sscanf(s, "%15[a-z0-9]@%ux%u", enc, &c->rate, &c->channels) < 2 || !c->rate || !c->channels || c->channels > 2) {
+		return -1;
+	}
+
+	if (!strcmp(enc, "l16")) {
+		c->encoding = AMD_TOOL_PCM16;
+	} else if (!strcmp(enc, "ulaw")) {
+		c->encoding = AMD_TOOL_ULAW;
+	} else if (!strcmp(enc, "alaw")) {
+		c->encoding = AMD_TOOL_ALAW;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+static int load_corpus(const char *corpus, const char *dir)
+{
+	FILE *fp = fopen(corpus, "r");
+	char line[2048], base[PATH_MAX], path[PATH_MAX];
+	const char *slash = strrchr(corpus, '/');
+	int lineno = 0;
+
+	if (!fp) {
+		perror(corpus);
+		return -1;
+	}
+
+	snprintf(base, sizeof(base), "%.*s", slash ? (int) (slash - corpus) : 1, slash ? corpus : ".");
+
+	while (fgets(line, sizeof(line), fp)) {
+		test_case_t *c = &cases[ncases];
+		char format[32];
+		int used = 0;
+
+		lineno++;
+		if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line)) {
+			continue;
+		}
+		if (ncases == TEST_MAX_CASES) {
+			fprintf(stderr, "%s:%d: too many entries\n", corpus, lineno);
+			break;
+		}
+
+		memset(c, 0, sizeof(*c));
+		if (sscanf(line, "%63s %31s %255s %15s %31s %n", c->name, format, c->params, c->status, c->result, &used) < 5 ||
+			!used || parse_format(format, c)) {
+			fprintf(stderr, "%s:%d: malformed entry\n", corpus, lineno);
+			fclose(fp);
+			return -1;
+		}
+		snprintf(c->audio, sizeof(c->audio), "%s", line + used);
+		c->audio[strcspn(c->audio, "\r\n")] = '\0';
+
+		if (c->audio[0] == '@') {
+			snprintf(path, sizeof(path), "%.2000s/%.1000s", base, c->audio + 1);
+		} else {
+			snprintf(path, sizeof(path), "%.2000s/%s.wav", dir, c->name);
+		}
+		memcpy(c->path, path, sizeof(path));
+		amd_params_parse(&c->p, strcmp(c->params, "-") ? c->params : NULL, NULL);
+		ncases++;
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+/*
+ * Synthesis
+ */
+
+static uint32_t rng_next(uint64_t *rng)
+{
+	*rng = *rng * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (uint32_t) (*rng >> 33);
+}
+
+/* Uniform in [-amp, amp] */
+static int32_t rng_noise(uint64_t *rng, int32_t amp)
+{
+	return (int32_t) (rng_next(rng) % (uint32_t) (2 * amp + 1)) - amp;
+}
+
+/*
+ * s: room silence, n: background noise below the default threshold,
+ * v: voiced speech (harmonic series with syllable-rate envelope),
+ * h: held vowel (the same harmonics at a steady level), t: 1kHz beep
+ */
+static void synth(int16_t *out, uint32_t n, uint32_t rate, char kind, uint64_t *rng)
+{
+	double f0 = 100 + rng_next(rng) % 100, phase[6];
+	uint32_t i;
+	int k;
+
+	for (k = 0; k < 6; k++) {
+		phase[k] = (rng_next(rng) % 628) / 100.0;
+	}
+
+	for (i = 0; i < n; i++) {
+		double t = (double) i / rate, x = 0;
+
+		switch (kind) {
+		case 'v':
+			for (k = 0; k < 6; k++) {
+				x += sin(2 * M_PI * f0 * (k + 1) * t + phase[k]) / (k + 1);
+			}
+			x *= 4000 * (0.7 + 0.3 * sin(2 * M_PI * 4 * t));
+			x += rng_noise(rng, 24);
+			break;
+		case 'h':
+			for (k = 0; k < 6; k++) {
+				x += sin(2 * M_PI * f0 * (k + 1) * t + phase[k]) / (k + 1);
+			}
+			x = x * 3400 + rng_noise(rng, 24);
+			break;
+		case 't':
+			x = 8000 * sin(2 * M_PI * 1000 * t);
+			break;
+		case 'n':
+			x = rng_noise(rng, 300);
+			break;
+		default:
+			x = rng_noise(rng, 24);
+			break;
+		}
+
+		out[i] = (int16_t) (x > INT16_MAX ? INT16_MAX : (x < INT16_MIN ? INT16_MIN : x));
+	}
+}
+
+/* Append the segments of one channel ("s500 3*(v300,s150) ...") to buf */
+static int synth_channel(const char *spec, uint32_t rate, uint64_t *rng, int16_t **buf, uint32_t *len, uint32_t *cap)
+{
+	const char *p = spec;
+
+	while (*p) {
+		const char *group;
+		int repeat = 1, r;
+		size_t glen;
+
+		p += strspn(p, " \t");
+		if (!*p) {
+			break;
+		}
+
+		if (strchr("0123456789", *p)) {
+			repeat = (int) strtol(p, (char **) &p, 10);
+			if (*p++ != '*' || *p++ != '(') {
+				return -1;
+			}
+			group = p;
+			glen = strcspn(p, ")");
+			p += glen + (p[glen] == ')');
+		} else {
+			group = p;
+			glen = strcspn(p, " \t");
+			p += glen;
+		}
+
+		for (r = 0; r < repeat; r++) {
+			const char *s = group;
+
+			while (s < group + glen) {
+				char kind = *s++;
+				uint32_t ms = (uint32_t) strtoul(s, (char **) &s, 10), n = rate * ms / 1000;
+
+				if (!strchr("svhnt", kind) || !ms) {
+					return -1;
+				}
+				if (*len + n > *cap) {
+					int16_t *nbuf;
+
+					*cap = (*len + n) * 2;
+					if (!(nbuf = realloc(*buf, *cap * sizeof(int16_t)))) {
+						return -1;
+					}
+					*buf = nbuf;
+				}
+				synth(*buf + *len, n, rate, kind, rng);
+				*len += n;
+				s += *s == ',';
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Linear to G.711, as in the classic Sun reference code */
+static uint8_t ulaw_encode(int16_t pcm)
+{
+	static const int16_t seg_end[8] = { 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF };
+	int32_t v = pcm >> 2;
+	uint8_t mask = 0xFF;
+	int seg;
+
+	if (v < 0) {
+		v = -v;
+		mask = 0x7F;
+	}
+	if (v > 8159) {
+		v = 8159;
+	}
+	v += 0x84 >> 2;
+
+	for (seg = 0; seg < 8 && v > seg_end[seg]; seg++);
+	if (seg >= 8) {
+		return 0x7F ^ mask;
+	}
+
+	return (uint8_t) (((seg << 4) | ((v >> (seg + 1)) & 0x0F)) ^ mask);
+}
+
+static uint8_t alaw_encode(int16_t pcm)
+{
+	static const int16_t seg_end[8] = { 0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF };
+	int32_t v = pcm >> 3;
+	uint8_t mask = 0xD5;
+	int seg;
+
+	if (v < 0) {
+		v = -v - 1;
+		mask = 0x55;
+	}
+
+	for (seg = 0; seg < 8 && v > seg_end[seg]; seg++);
+	if (seg >= 8) {
+		return 0x7F ^ mask;
+	}
+
+	return (uint8_t) (((seg << 4) | ((v >> (seg < 2 ? 1 : seg)) & 0x0F)) ^ mask);
+}
+
+static void put_le(FILE *fp, uint32_t v, int bytes)
+{
+	while (bytes--) {
+		fputc(v & 0xFF, fp);
+		v >>= 8;
+	}
+}
+
+static int write_wav(const test_case_t *c, const int16_t *const *chan, uint32_t samples)
+{
+	uint32_t width = c->encoding == AMD_TOOL_PCM16 ? 2 : 1, data = samples * c->channels * width, i, ch;
+	uint16_t tag = c->encoding == AMD_TOOL_PCM16 ? 1 : (c->encoding == AMD_TOOL_ULAW ? 7 : 6);
+	FILE *fp = fopen(c->path, "wb");
+
+	if (!fp) {
+		perror(c->path);
+		return -1;
+	}
+
+	fputs("RIFF", fp);
+	put_le(fp, 36 + data, 4);
+	fputs("WAVEfmt ", fp);
+	put_le(fp, 16, 4);
+	put_le(fp, tag, 2);
+	put_le(fp, c->channels, 2);
+	put_le(fp, c->rate, 4);
+	put_le(fp, c->rate * c->channels * width, 4);
+	put_le(fp, c->channels * width, 2);
+	put_le(fp, width * 8, 2);
+	fputs("data", fp);
+	put_le(fp, data, 4);
+
+	for (i = 0; i < samples; i++) {
+		for (ch = 0; ch < c->channels; ch++) {
+			int16_t s = chan[ch][i];
+
+			if (c->encoding == AMD_TOOL_PCM16) {
+				put_le(fp, (uint16_t) s, 2);
+			} else {
+				fputc(c->encoding == AMD_TOOL_ULAW ? ulaw_encode(s) : alaw_encode(s), fp);
+			}
+		}
+	}
+
+	return fclose(fp) ? -1 : 0;
+}
+
+static int gen(const char *dir)
+{
+	int i, failed = 0;
+
+	if (mkdir(dir, 0755) && errno != EEXIST) {
+		perror(dir);
+		return 1;
+	}
+
+	for (i = 0; i < ncases; i++) {
+		test_case_t *c = &cases[i];
+		int16_t *chan[2] = { NULL, NULL };
+		uint32_t len[2] = { 0, 0 }, cap[2] = { 0, 0 }, samples, ch;
+		uint64_t rng = 0x9E3779B97F4A7C15ULL;
+		char spec[sizeof(c->audio)], *bar;
+		const char *p;
+
+		if (c->audio[0] == '@') {
+			continue;
+		}
+
+		/* Seeded by name: regenerating gives byte-identical files */
+		for (p = c->name; *p; p++) {
+			rng = (rng ^ (uint8_t) *p) * 0x100000001B3ULL;
+		}
+
+		snprintf(spec, sizeof(spec), "%s", c->audio);
+		if ((bar = strchr(spec, '|'))) {
+			*bar++ = '\0';
+		}
+		if ((bar && c->channels < 2) ||
+			synth_channel(spec, c->rate, &rng, &chan[0], &len[0], &cap[0]) ||
+			(bar && synth_channel(bar, c->rate, &rng, &chan[1], &len[1], &cap[1]))) {
+			fprintf(stderr, "%s: bad audio spec '%s'\n", c->name, c->audio);
+			failed++;
+			continue;
+		}
+
+		/* Pad both channels to the same length with silence */
+		samples = len[0] > len[1] ? len[0] : len[1];
+		for (ch = 0; ch < c->channels; ch++) {
+			int16_t *nbuf = realloc(chan[ch], (samples ? samples : 1) * sizeof(int16_t));
+
+			if (!nbuf) {
+				return 1;
+			}
+			chan[ch] = nbuf;
+			synth(chan[ch] + len[ch], samples - len[ch], c->rate, 's', &rng);
+		}
+
+		if (write_wav(c, (const int16_t *const *) chan, samples)) {
+			failed++;
+		}
+		free(chan[0]);
+		free(chan[1]);
+	}
+
+	return failed ? 1 : 0;
+}
+
+/*
+ * Golden verdicts
+ */
+
+/*
+ * Greeting fingerprints: steady openings (a tone, noise, a held vowel) give
+ * flat keys that would match any other steady opening, so they must be
+ * rejected; a greeting with word gaps must give a usable key, and so must
+ * an envelope that only moves a little below the first frame's level.
+ * dip_frames > 0 scales every other run of that many frames by dip_gain.
+ * decimate > 1 passes audio for only 1 in that many frames, as load shedding
+ * does; the skipped frames repeat the last level.
+ */
+static const struct {
+	const char *name;
+	const char *audio;
+	int usable;
+	uint32_t dip_frames;
+	double dip_gain;
+	uint32_t decimate;
+} fp_cases[] = {
+	{ "fingerprint-tone", "t1000", 0, 0, 1, 1 },
+	{ "fingerprint-noise", "n1000", 0, 0, 1, 1 },
+	{ "fingerprint-vowel", "h1000", 0, 0, 1, 1 },
+	{ "fingerprint-greeting", "5*(v80,s60) v400", 1, 0, 1, 1 },
+	{ "fingerprint-syllables", "v1000", 1, 0, 1, 1 },
+	{ "fingerprint-dip", "t1000", 1, 3, 0.7, 1 },  /* -3dB, -1 bit */
+	{ "fingerprint-tone-decimated", "t1000", 0, 0, 1, 2 },
+	{ "fingerprint-decimated", "5*(v80,s60) v400", 1, 0, 1, 2 },
+};
+
+static int check_fingerprints(int *total)
+{
+	size_t i;
+	int failed = 0;
+
+	for (i = 0; i < sizeof(fp_cases) / sizeof(fp_cases[0]); i++) {
+		amd_vad_hot_t hot;
+		amd_pcm_t pcm;
+		int16_t *buf = NULL;
+		uint32_t len = 0, cap = 0, at, frame = 8000 * TEST_FRAME_MS / 1000;
+		uint64_t rng = 1;
+		int usable = 0;
+
+		(*total)++;
+		memset(&hot, 0, sizeof(hot));
+		if (synth_channel(fp_cases[i].audio, 8000, &rng, &buf, &len, &cap)) {
+			printf("FAIL %-28s bad audio spec\n", fp_cases[i].name);
+			failed++;
+			free(buf);
+			continue;
+		}
+
+		for (at = 0; at + frame <= len && !hot.fp_done; at += frame) {
+			if (fp_cases[i].dip_frames && (at / frame / fp_cases[i].dip_frames) % 2) {
+				uint32_t k;
+
+				for (k = 0; k < frame; k++) {
+					buf[at + k] = (int16_t) (buf[at + k] * fp_cases[i].dip_gain);
+				}
+			}
+			pcm.data = buf + at;
+			pcm.samples = frame;
+			pcm.channels = 1;
+			pcm.rate = 8000;
+			usable = amd_fp_update(&hot, (at / frame) % fp_cases[i].decimate ? NULL : &pcm, VOICED);
+		}
+		free(buf);
+
+		if (!hot.fp_done || usable != fp_cases[i].usable || (!usable && hot.fp_key)) {
+			printf("FAIL %-28s expected %s key, got %s\n", fp_cases[i].name,
+				   fp_cases[i].usable ? "a usable" : "no", usable ? "a usable one" : "none");
+			failed++;
+		} else {
+			printf("ok   %-28s %s\n", fp_cases[i].name, usable ? "usable" : "rejected");
+		}
+	}
+
+	return failed;
+}
+
+/*
+ * Reference state machine: the branch tree amd_callback ran before
+ * amd_sm_step, with logging dropped and each verdict returned where it used
+ * to be published. amd_sm_step must agree with it frame by frame. Kept out
+ * of line so bench times it as a call, like amd_sm_step in amd_core.o.
+ */
+#define REF_CALLS 200000
+#define REF_MAX_FRAMES 1000
+
+typedef struct {
+	uint32_t frame_ms, total_duration, silence_duration, voice_duration, current_word_duration;
+	uint32_t intro_voice_duration, words, intro_words, last_noise_start, last_noise_end;
+	uint32_t word_counted, in_initial_silence, in_intro, max_intro_checked, silent_after_intro_checked;
+	uint32_t talking, had_silence_break;
+	uint32_t silent_initial, silent_after_intro, silent_max_session, noise_max_intro;
+	uint32_t noise_min_length, noise_inter_silence, noise_max_count;
+} ref_hot_t;
+
+static __attribute__((noinline)) amd_verdict_t ref_step(ref_hot_t *hot, amd_frame_classifier frame_type)
+{
+	if (frame_type == VOICED) {
+		hot->talking = 1;
+		hot->voice_duration += hot->frame_ms;
+		hot->current_word_duration += hot->frame_ms;
+		hot->silence_duration = 0;
+
+		if (hot->in_initial_silence) {
+			hot->in_initial_silence = 0;
+			hot->in_intro = 1;
+			hot->intro_voice_duration = hot->frame_ms;
+			hot->had_silence_break = 0;
+		} else if (hot->in_intro) {
+			if (hot->had_silence_break) {
+				hot->intro_voice_duration = hot->frame_ms;
+				hot->had_silence_break = 0;
+			} else {
+				hot->intro_voice_duration += hot->frame_ms;
+			}
+		}
+
+		if (hot->in_intro && hot->total_duration >= hot->noise_max_intro) {
+			hot->in_intro = 0;
+			hot->max_intro_checked = 1;
+		}
+
+		if (hot->current_word_duration >= hot->noise_min_length && !hot->word_counted) {
+			hot->words++;
+			if (hot->total_duration < hot->noise_max_intro) {
+				hot->intro_words++;
+			}
+			hot->word_counted = 1;
+			hot->last_noise_start = hot->total_duration;
+		}
+
+		if (!hot->max_intro_checked && hot->words == 1 && hot->in_intro &&
+			hot->current_word_duration >= hot->noise_max_intro) {
+			return AMD_VERDICT_MAX_INTRO;
+		}
+
+		if (hot->words >= hot->noise_max_count) {
+			return AMD_VERDICT_MAX_COUNT;
+		}
+
+		hot->last_noise_end = hot->total_duration;
+	} else {
+		hot->talking = 0;
+		hot->silence_duration += hot->frame_ms;
+		hot->voice_duration = 0;
+
+		if (hot->in_intro && hot->total_duration >= hot->noise_max_intro) {
+			hot->in_intro = 0;
+			hot->max_intro_checked = 1;
+		}
+
+		if (hot->in_intro && hot->silence_duration >= hot->noise_inter_silence) {
+			hot->had_silence_break = 1;
+			hot->intro_voice_duration = 0;
+		}
+
+		if (hot->silence_duration >= hot->noise_inter_silence) {
+			hot->current_word_duration = 0;
+			hot->word_counted = 0;
+		}
+
+		if (hot->in_initial_silence && hot->silence_duration >= hot->silent_initial) {
+			return AMD_VERDICT_SILENT_INITIAL;
+		}
+
+		if (!hot->silent_after_intro_checked && hot->words == 1 && hot->silence_duration >= hot->silent_after_intro) {
+			return AMD_VERDICT_SILENT_AFTER_INTRO;
+		}
+
+		if (hot->silence_duration >= hot->silent_max_session && hot->words > 0) {
+			return AMD_VERDICT_SILENT_MAX_SESSION;
+		}
+	}
+
+	return AMD_VERDICT_NONE;
+}
+
+/*
+ * in_intro as amd_status and amd_list report it: false in the initial
+ * silence, true from the first voice until noise_max_intro, false after.
+ */
+static int check_intro_flag(int *total)
+{
+	amd_params_t none = { 0 }, defaults = AMD_TOOL_DEFAULTS;
+	amd_vad_hot_t hot;
+	const char *fail = NULL;
+	uint32_t ms;
+
+	(*total)++;
+	memset(&hot, 0, sizeof(hot));
+	amd_resolve_params(&hot, &none, &defaults);
+	hot.frame_ms = TEST_FRAME_MS;
+
+	for (ms = 0; ms < 500 && !fail; ms += TEST_FRAME_MS) {
+		hot.total_duration += TEST_FRAME_MS;
+		amd_sm_step(&hot, SILENCE);
+		if (amd_sm_in_intro(hot.state)) {
+			fail = "in_intro during the initial silence";
+		}
+	}
+	hot.total_duration += TEST_FRAME_MS;
+	amd_sm_step(&hot, VOICED);
+	if (!fail && !amd_sm_in_intro(hot.state)) {
+		fail = "no in_intro after the first voice";
+	}
+	while (!fail && hot.total_duration < hot.noise_max_intro) {
+		hot.total_duration += TEST_FRAME_MS;
+		amd_sm_step(&hot, (hot.total_duration / 200) % 2 ? VOICED : SILENCE);
+	}
+	if (!fail && amd_sm_in_intro(hot.state)) {
+		fail = "in_intro after noise_max_intro";
+	}
+
+	if (fail) {
+		printf("FAIL %-28s %s\n", "in-intro", fail);
+		return 1;
+	}
+	printf("ok   %-28s initial silence, intro, after\n", "in-intro");
+	return 0;
+}
+
+/* Threshold in [1, max] ms, or the default for a quarter of the calls */
+static uint32_t ref_param(uint64_t *rng, uint32_t max, uint32_t def, int use_defaults)
+{
+	return use_defaults ? def : 1 + rng_next(rng) % max;
+}
+
+static int check_reference(int *total)
+{
+	amd_params_t defaults = AMD_TOOL_DEFAULTS;
+	uint64_t rng = 1, frames = 0;
+	uint32_t call, verdicts[AMD_VERDICT_SILENT_MAX_SESSION + 1] = { 0 }, v;
+
+	(*total)++;
+
+	for (call = 0; call < REF_CALLS; call++) {
+		int use_defaults = !(rng_next(&rng) % 4);
+		uint32_t frame, run = 0;
+		amd_frame_classifier frame_type = VOICED;
+		amd_vad_hot_t hot;
+		ref_hot_t ref;
+
+		memset(&hot, 0, sizeof(hot));
+		memset(&ref, 0, sizeof(ref));
+		ref.in_initial_silence = 1;
+		ref.frame_ms = hot.frame_ms = rng_next(&rng) % 2 ? 10 : 20;
+		ref.silent_initial = hot.silent_initial = ref_param(&rng, 6000, defaults.silent_initial, use_defaults);
+		ref.silent_after_intro = hot.silent_after_intro = ref_param(&rng, 2000, defaults.silent_after_intro, use_defaults);
+		ref.silent_max_session = hot.silent_max_session = ref_param(&rng, 2000, defaults.silent_max_session, use_defaults);
+		ref.noise_max_intro = hot.noise_max_intro = ref_param(&rng, 3000, defaults.noise_max_intro, use_defaults);
+		ref.noise_min_length = hot.noise_min_length = ref_param(&rng, 400, defaults.noise_min_length, use_defaults);
+		ref.noise_inter_silence = hot.noise_inter_silence = ref_param(&rng, 300, defaults.noise_inter_silence, use_defaults);
+		ref.noise_max_count = hot.noise_max_count = ref_param(&rng, 12, defaults.noise_max_count, use_defaults);
+
+		for (frame = 0; frame < REF_MAX_FRAMES; frame++) {
+			amd_verdict_t want, got;
+
+			/* Alternating voice and silence runs of 1-40 frames */
+			if (!run) {
+				frame_type = frame_type == VOICED ? SILENCE : VOICED;
+				run = 1 + rng_next(&rng) % 40;
+			}
+			run--;
+
+			ref.total_duration += ref.frame_ms;
+			hot.total_duration += hot.frame_ms;
+			want = ref_step(&ref, frame_type);
+			got = amd_sm_step(&hot, frame_type);
+			frames++;
+
+			if (want != got || (want == AMD_VERDICT_NONE &&
+				((uint32_t) amd_sm_in_intro(hot.state) != ref.in_intro || ref.words != hot.words || ref.intro_words != hot.intro_words ||
+				 ref.silence_duration != hot.silence_duration || ref.voice_duration != hot.voice_duration ||
+				 ref.current_word_duration != hot.current_word_duration ||
+				 ref.intro_voice_duration != hot.intro_voice_duration ||
+				 ref.last_noise_start != hot.last_noise_start || ref.last_noise_end != hot.last_noise_end))) {
+				printf("FAIL %-28s call %u frame %u: expected %s (%u words), got %s (%u words)\n",
+					   "reference-state-machine", call, frame, amd_verdicts[want].name, ref.words,
+					   amd_verdicts[got].name, hot.words);
+				return 1;
+			}
+			if (want != AMD_VERDICT_NONE) {
+				verdicts[want]++;
+				break;
+			}
+		}
+		if (frame == REF_MAX_FRAMES) {
+			verdicts[AMD_VERDICT_NONE]++;
+		}
+	}
+
+	printf("ok   %-28s %u calls, %" PRIu64 " frames, verdicts:", "reference-state-machine", REF_CALLS, frames);
+	for (v = AMD_VERDICT_NONE; v <= AMD_VERDICT_SILENT_MAX_SESSION; v++) {
+		printf(" %s %u", amd_verdicts[v].name, verdicts[v]);
+	}
+	printf("\n");
+	return 0;
+}
+
+static int check(void)
+{
+	amd_params_t defaults = AMD_TOOL_DEFAULTS;
+	amd_tool_ctx_t ctx;
+	int i, failed = 0, total = ncases;
+
+	if (amd_tool_ctx_init(&ctx)) {
+		return 1;
+	}
+
+	for (i = 0; i < ncases; i++) {
+		const test_case_t *c = &cases[i];
+		const amd_verdict_info_t *v;
+		const char *status, *result;
+		amd_tool_result_t r;
+		amd_tool_file_t f;
+
+		if (amd_tool_open(&f, c->path, c->rate, c->channels)) {
+			failed++;
+			continue;
+		}
+		amd_tool_run(&ctx, &f, &c->p, &defaults, TEST_FRAME_MS, &r);
+		amd_tool_close(&f);
+
+		v = &amd_verdicts[r.verdict];
+		status = v->status ? v->status : "-";
+		result = v->result ? v->result : "-";
+
+		if (strcmp(status, c->status) || strcmp(result, c->result)) {
+			printf("FAIL %-28s expected %s/%s, got %s/%s (%s at %ums)\n",
+				   c->name, c->status, c->result, status, result, v->name, r.decision_ms);
+			failed++;
+		} else {
+			printf("ok   %-28s %s/%s at %ums\n", c->name, status, result, r.decision_ms);
+		}
+	}
+	amd_tool_ctx_destroy(&ctx);
+
+	failed += check_fingerprints(&total);
+	failed += check_intro_flag(&total);
+	failed += check_reference(&total);
+
+	printf("%d/%d passed\n", total - failed, total);
+	return failed ? 1 : 0;
+}
+
+/*
+ * Benchmarks
+ */
+
+/* Hardware cache misses of this thread, or -1 where perf events are not available */
+static int misses_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static double misses_read(int fd)
+{
+	uint64_t count;
+
+	if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) {
+		return -1;
+	}
+
+	return (double) count;
+}
+
+/*
+ * Calibration kernel: a sum of squares over one 20ms 8kHz frame, built into
+ * amd_test so it does not move with the code under test. Rows are reported
+ * as a ratio to it, which cancels most of the clock and load differences
+ * between runs. Returns ns per pass.
+ */
+static double calibrate(void)
+{
+	static int16_t buf[CALIB_SAMPLES];
+	uint64_t start, power = 0;
+	uint32_t loop, j;
+
+	for (j = 0; j < CALIB_SAMPLES; j++) {
+		buf[j] = (int16_t) (j * 97 - 7000);
+	}
+
+	start = amd_tool_thread_ns();
+	for (loop = 0; loop < CALIB_LOOPS; loop++) {
+		/* Reload the frame every pass, as an engine would */
+		__asm__ volatile("" : : "r"(buf) : "memory");
+		for (j = 0; j < CALIB_SAMPLES; j++) {
+			power += (uint64_t) (buf[j] * buf[j]);
+		}
+	}
+	__asm__ volatile("" : : "r"(power));
+
+	return (double) (amd_tool_thread_ns() - start) / CALIB_LOOPS;
+}
+
+/* Whole corpus through amd_tool_run with the engine forced, BENCH_LOOPS times */
+static void bench_engine(amd_tool_ctx_t *ctx, const amd_tool_file_t *files, const amd_engine_t *engine, bench_row_t *row)
+{
+	amd_params_t defaults = AMD_TOOL_DEFAULTS;
+	uint64_t ns = 0, frames = 0, decision_ms = 0, decided = 0;
+	int loop, i;
+
+	row->name = engine->name;
+	row->misses_per_frame = -1;
+
+	for (loop = 0; loop < BENCH_LOOPS; loop++) {
+		for (i = 0; i < ncases; i++) {
+			amd_params_t p = cases[i].p;
+			amd_tool_result_t r;
+
+			p.engine = engine;
+			amd_tool_run(ctx, &files[i], &p, &defaults, TEST_FRAME_MS, &r);
+			ns += r.ns;
+			frames += r.frames;
+			if (amd_verdicts[r.verdict].status) {
+				decision_ms += r.decision_ms;
+				decided++;
+			}
+		}
+	}
+
+	row->ns_per_frame = frames ? (double) ns / frames : -1;
+	row->decision_ms = decided ? (double) decision_ms / decided : -1;
+}
+
+/*
+ * Decision rules alone, replayed over frame types classified up front:
+ * amd_step, or with tree set the reference branch tree it replaced; both
+ * account each frame with amd_advance.
+ */
+static void bench_sm(amd_tool_ctx_t *ctx, const amd_tool_file_t *files, int tree, bench_row_t *row)
+{
+	amd_params_t defaults = AMD_TOOL_DEFAULTS;
+	amd_vad_hot_t *hot = ctx->hot;
+	uint8_t *types[TEST_MAX_CASES];
+	uint32_t nframes[TEST_MAX_CASES];
+	uint64_t start, frames = 0;
+	int loop, i;
+	uint32_t n;
+
+	row->name = tree ? "reference-tree" : "state-machine";
+	row->decision_ms = -1;
+	row->misses_per_frame = -1;
+
+	for (i = 0; i < ncases; i++) {
+		amd_pcm_t pcm;
+
+		nframes[i] = amd_tool_frames(&files[i], TEST_FRAME_MS);
+		types[i] = calloc(nframes[i] + 1, 1);
+
+		memset(hot, 0, sizeof(*hot));
+		amd_resolve_params(hot, &cases[i].p, &defaults);
+		for (n = 0; n < nframes[i]; n++) {
+			amd_tool_frame(&files[i], TEST_FRAME_MS, n, ctx->buf, &pcm);
+			types[i][n] = amd_classify_frame(&pcm, hot->silent_threshold, NULL) == VOICED;
+		}
+	}
+
+	start = amd_tool_thread_ns();
+	for (loop = 0; loop < BENCH_SM_LOOPS; loop++) {
+		for (i = 0; i < ncases; i++) {
+			amd_pcm_t pcm = { NULL, files[i].rate * TEST_FRAME_MS / 1000, 1, files[i].rate };
+
+			memset(hot, 0, sizeof(*hot));
+			hot->state = AMD_SM_INITIAL_SILENCE;
+			amd_resolve_params(hot, &cases[i].p, &defaults);
+			hot->dual = 0;
+
+			if (tree) {
+				ref_hot_t ref;
+
+				memset(&ref, 0, sizeof(ref));
+				ref.in_initial_silence = 1;
+				ref.silent_initial = hot->silent_initial;
+				ref.silent_after_intro = hot->silent_after_intro;
+				ref.silent_max_session = hot->silent_max_session;
+				ref.noise_max_intro = hot->noise_max_intro;
+				ref.noise_min_length = hot->noise_min_length;
+				ref.noise_inter_silence = hot->noise_inter_silence;
+				ref.noise_max_count = hot->noise_max_count;
+
+				for (n = 0; n < nframes[i]; n++) {
+					if (amd_advance(hot, &pcm) != AMD_VERDICT_NONE) {
+						break;
+					}
+					ref.frame_ms = hot->frame_ms;
+					ref.total_duration = hot->total_duration;
+					frames++;
+					if (ref_step(&ref, types[i][n] ? VOICED : SILENCE) != AMD_VERDICT_NONE) {
+						break;
+					}
+				}
+				continue;
+			}
+
+			for (n = 0; n < nframes[i]; n++) {
+				if (amd_advance(hot, &pcm) != AMD_VERDICT_NONE) {
+					break;
+				}
+				hot->frames++;
+				if (amd_step(hot, types[i][n] ? VOICED : SILENCE) != AMD_VERDICT_NONE) {
+					break;
+				}
+			}
+			frames += hot->frames;
+		}
+	}
+	row->ns_per_frame = frames ? (double) (amd_tool_thread_ns() - start) / frames : -1;
+
+	for (i = 0; i < ncases; i++) {
+		free(types[i]);
+	}
+}
+/*
+ * BENCH_SESSIONS concurrent calls, one frame each per tick, as a busy box
+ * interleaves them: hot blocks come from one aligned array like the module
+ * slab, and every session has its own frame buffer that the "codec" writes
+ * before classification. Uses the 8kHz mono L16 files of the corpus.
+ */
+static void bench_sessions(const amd_tool_file_t *files, bench_row_t *row)
+{
+	amd_params_t params = { 0 }, defaults = AMD_TOOL_DEFAULTS;
+	const uint32_t spf = 8000 * TEST_FRAME_MS / 1000;
+	const amd_tool_file_t *mono[TEST_MAX_CASES];
+	amd_vad_hot_t *hot = NULL;
+	int16_t *bufs = NULL, scratch[AMD_TOOL_MAX_FRAME];
+	uint32_t *pos = NULL, *src = NULL, s, tick, nmono = 0;
+	uint64_t start, frames = 0;
+	double misses;
+	int i, fd;
+
+	row->name = "sessions-10k";
+	row->ns_per_frame = -1;
+	row->decision_ms = -1;
+	row->misses_per_frame = -1;
+
+	for (i = 0; i < ncases; i++) {
+		if (files[i].rate == 8000 && files[i].channels == 1 && files[i].encoding == AMD_TOOL_PCM16) {
+			mono[nmono++] = &files[i];
+		}
+	}
+
+	if (!nmono || posix_memalign((void **) &hot, 64, BENCH_SESSIONS * sizeof(amd_vad_hot_t)) ||
+		!(bufs = malloc((size_t) BENCH_SESSIONS * spf * sizeof(int16_t))) ||
+		!(pos = calloc(BENCH_SESSIONS, sizeof(uint32_t))) || !(src = calloc(BENCH_SESSIONS, sizeof(uint32_t)))) {
+		goto done;
+	}
+
+	for (s = 0; s < BENCH_SESSIONS; s++) {
+		src[s] = s % nmono;
+		pos[s] = s % amd_tool_frames(mono[src[s]], TEST_FRAME_MS);  /* Spread the sessions over their calls */
+		memset(&hot[s], 0, sizeof(amd_vad_hot_t));
+		hot[s].state = AMD_SM_INITIAL_SILENCE;
+		amd_resolve_params(&hot[s], &params, &defaults);
+	}
+
+	fd = misses_open();
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	start = amd_tool_thread_ns();
+
+	for (tick = 0; tick < BENCH_TICKS; tick++) {
+		for (s = 0; s < BENCH_SESSIONS; s++) {
+			const amd_tool_file_t *f = mono[src[s]];
+			int16_t *buf = bufs + (size_t) s * spf;
+			amd_verdict_t verdict;
+			amd_frame_classifier frame_type;
+			amd_pcm_t pcm;
+
+			if (pos[s] >= amd_tool_frames(f, TEST_FRAME_MS)) {
+				verdict = AMD_VERDICT_TOO_LONG;
+			} else {
+				amd_tool_frame(f, TEST_FRAME_MS, pos[s]++, scratch, &pcm);
+				memcpy(buf, pcm.data, spf * sizeof(int16_t));
+				pcm.data = buf;
+
+				if ((verdict = amd_advance(&hot[s], &pcm)) == AMD_VERDICT_NONE) {
+					hot[s].frames++;
+					frame_type = amd_engine_frame(&hot[s], &amd_energy_engine, NULL, &pcm, &verdict);
+					if (verdict == AMD_VERDICT_NONE) {
+						verdict = amd_step(&hot[s], frame_type);
+					}
+				}
+				frames++;
+			}
+
+			/* Next call on this channel */
+			if (verdict != AMD_VERDICT_NONE) {
+				memset(&hot[s], 0, sizeof(amd_vad_hot_t));
+				hot[s].state = AMD_SM_INITIAL_SILENCE;
+				amd_resolve_params(&hot[s], &params, &defaults);
+				pos[s] = 0;
+			}
+		}
+	}
+
+	row->ns_per_frame = frames ? (double) (amd_tool_thread_ns() - start) / frames : -1;
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (frames && (misses = misses_read(fd)) >= 0) {
+			row->misses_per_frame = misses / frames;
+		}
+		close(fd);
+	}
+
+done:
+	free(hot);
+	free(bufs);
+	free(pos);
+	free(src);
+}
+
+
+/* "name value" lines: committed decision_ms expectations, or this machine's timing ratios */
+typedef struct {
+	char *name;
+	double value;
+} bench_ref_t;
+
+static int load_refs(const char *path, bench_ref_t *refs, int max)
+{
+	FILE *fp = fopen(path, "r");
+	char line[256], name[64];
+	double value;
+	int n = 0;
+
+	if (!fp) {
+		return 0;
+	}
+
+	while (n < max && fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || sscanf(line, "%63s %lf", name, &value) != 2) {
+			continue;
+		}
+		refs[n].name = strdup(name);
+		refs[n].value = value;
+		n++;
+	}
+	fclose(fp);
+
+	return n;
+}
+
+static const bench_ref_t *find_ref(const bench_ref_t *refs, int n, const char *name)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (!strcmp(refs[i].name, name)) {
+			return &refs[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void free_refs(bench_ref_t *refs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		free(refs[i].name);
+	}
+}
+
+static int save_baseline(const char *path, const bench_row_t *rows, int n)
+{
+	FILE *fp = fopen(path, "w");
+	int i;
+
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	fprintf(fp, "# make bench timing baseline for this machine only, rewrite with make bench-baseline\n");
+	fprintf(fp, "# name ratio (ns/frame over calibration ns/pass)\n");
+	for (i = 0; i < n; i++) {
+		if (rows[i].ratio >= 0) {
+			fprintf(fp, "%s %.4f\n", rows[i].name, rows[i].ratio);
+		}
+	}
+
+	return fclose(fp) ? -1 : 0;
+}
+
+static void cell_num(char *cell, double v, int precision)
+{
+	if (v < 0) {
+		strcpy(cell, "-");
+	} else {
+		snprintf(cell, 32, "%.*f", precision, v);
+	}
+}
+
+/* Percent change, and whether it is a regression past tolerance */
+static int compare(double now, double base, double tolerance, double *change)
+{
+	*change = base > 0 ? (now - base) * 100 / base : 0;
+	return base > 0 && *change > tolerance;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static double median(double *v, int n)
+{
+	qsort(v, (size_t) n, sizeof(double), cmp_double);
+	return v[n / 2];
+}
+
+/* Row k of the table: each engine, the state machine, the reference tree, the sessions; -1 past the last */
+static int measure_row(amd_tool_ctx_t *ctx, const amd_tool_file_t *files, int k, bench_row_t *row)
+{
+	int i, e = 0;
+
+	for (i = 0; amd_engines[i]; i++) {
+		if (amd_engines[i] == &amd_model_engine && !amd_model.loaded) {
+			continue;
+		}
+		if (e++ == k) {
+			bench_engine(ctx, files, amd_engines[i], row);
+			return 0;
+		}
+	}
+
+	switch (k - e) {
+	case 0:
+		bench_sm(ctx, files, 0, row);
+		return 0;
+	case 1:
+		bench_sm(ctx, files, 1, row);
+		return 0;
+	case 2:
+		bench_sessions(files, row);
+		return 0;
+	}
+
+	return -1;
+}
+
+/* One round: every row once, each as a ratio to the calibration kernel timed around it */
+static int measure(amd_tool_ctx_t *ctx, const amd_tool_file_t *files, bench_row_t *rows, double *calib)
+{
+	double before, cal, sum = 0;
+	int k;
+
+	for (k = 0; k < BENCH_MAX_ROWS; k++) {
+		before = calibrate();
+		if (measure_row(ctx, files, k, &rows[k])) {
+			break;
+		}
+		cal = (before + calibrate()) / 2;
+		rows[k].ratio = rows[k].ns_per_frame >= 0 && cal > 0 ? rows[k].ns_per_frame / cal : -1;
+		sum += cal;
+	}
+	*calib = k ? sum / k : -1;
+
+	return k;
+}
+
+static int bench(const char *expect, const char *baseline, double tolerance, int update)
+{
+	static bench_row_t runs[BENCH_ROUNDS][BENCH_MAX_ROWS];
+	amd_tool_file_t files[TEST_MAX_CASES];
+	bench_row_t rows[BENCH_MAX_ROWS];
+	bench_ref_t want[16], base[16];
+	double v[3][BENCH_ROUNDS], calib[BENCH_ROUNDS];
+	amd_tool_ctx_t ctx;
+	int nrows = 0, nwant, nbase, round, i, changed = 0, slow = 0;
+
+	if (!(nwant = load_refs(expect, want, 16))) {
+		fprintf(stderr, "%s: no decision_ms expectations\n", expect);
+		return 1;
+	}
+
+	memset(files, 0, sizeof(files));
+	for (i = 0; i < ncases; i++) {
+		if (amd_tool_open(&files[i], cases[i].path, cases[i].rate, cases[i].channels)) {
+			return 1;
+		}
+	}
+	if (amd_tool_ctx_init(&ctx)) {
+		return 1;
+	}
+
+	/*
+	 * Rounds interleave the rows, so a neighbour stealing the CPU for a
+	 * while slows every row of the rounds it overlaps rather than one row
+	 * throughout, and the median of each row drops those rounds.
+	 */
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		nrows = measure(&ctx, files, runs[round], &calib[round]);
+	}
+	for (i = 0; i < nrows; i++) {
+		rows[i] = runs[0][i];
+		for (round = 0; round < BENCH_ROUNDS; round++) {
+			v[0][round] = runs[round][i].ns_per_frame;
+			v[1][round] = runs[round][i].ratio;
+			v[2][round] = runs[round][i].misses_per_frame;
+		}
+		rows[i].ns_per_frame = median(v[0], BENCH_ROUNDS);
+		rows[i].ratio = median(v[1], BENCH_ROUNDS);
+		rows[i].misses_per_frame = median(v[2], BENCH_ROUNDS);
+	}
+
+	amd_tool_ctx_destroy(&ctx);
+	for (i = 0; i < ncases; i++) {
+		amd_tool_close(&files[i]);
+	}
+
+	/* Ratios still only compare on the machine that made them: the first run here sets the baseline */
+	nbase = update ? 0 : load_refs(baseline, base, 16);
+	if (!nbase) {
+		if (save_baseline(baseline, rows, nrows)) {
+			free_refs(want, nwant);
+			return 1;
+		}
+		printf("timing baseline written to %s, later runs compare against it\n", baseline);
+	}
+
+	printf("calibration %.1f ns/pass, median of %d rounds\n", median(calib, BENCH_ROUNDS), BENCH_ROUNDS);
+	printf("%-14s %10s %8s %9s %8s %12s %10s %13s\n",
+		   "bench", "ns/frame", "ratio", "baseline", "change", "decision_ms", "expected", "misses/frame");
+
+	for (i = 0; i < nrows; i++) {
+		const bench_row_t *r = &rows[i];
+		const bench_ref_t *b = find_ref(base, nbase, r->name), *w = find_ref(want, nwant, r->name);
+		char cell[7][32];
+		const char *flag = "";
+		double change;
+
+		cell_num(cell[0], r->ns_per_frame, 1);
+		cell_num(cell[1], r->ratio, 3);
+		cell_num(cell[2], b ? b->value : -1, 3);
+		strcpy(cell[3], "-");
+		if (b && r->ratio >= 0) {
+			if (compare(r->ratio, b->value, tolerance, &change) && tolerance > 0) {
+				flag = "  SLOWER";
+				slow++;
+			}
+			snprintf(cell[3], sizeof(cell[3]), "%+.1f%%", change);
+		}
+
+		/* Decision times are deterministic: any difference is a behaviour change */
+		cell_num(cell[4], r->decision_ms, 1);
+		cell_num(cell[5], w ? w->value : -1, 1);
+		if (r->decision_ms >= 0 && (!w || fabs(r->decision_ms - w->value) > 0.05)) {
+			flag = "  CHANGED";
+			changed++;
+		}
+
+		strcpy(cell[6], "n/a");
+		if (r->misses_per_frame >= 0) {
+			snprintf(cell[6], sizeof(cell[6]), "%.2f", r->misses_per_frame);
+		}
+
+		printf("%-14s %10s %8s %9s %8s %12s %10s %13s%s\n",
+			   r->name, cell[0], cell[1], cell[2], cell[3], cell[4], cell[5], cell[6], flag);
+	}
+
+	free_refs(want, nwant);
+	free_refs(base, nbase);
+
+	if (changed) {
+		printf("%d decision time(s) differ from %s\n", changed, expect);
+	}
+	if (slow) {
+		printf("%d benchmark(s) more than %.0f%% slower than %s\n", slow, tolerance, baseline);
+	} else if (tolerance <= 0) {
+		printf("timings are report-only, set a tolerance to fail on them\n");
+	}
+	return changed || slow ? 1 : 0;
+}
+
+/*
+ * Engine comparison
+ */
+
+/*
+ * Every engine on every file, whatever engine the corpus line asks for,
+ * scored against the expected amd_status: accuracy next to CPU cost.
+ */
+static int compare_engines(void)
+{
+	amd_params_t defaults = AMD_TOOL_DEFAULTS;
+	const amd_engine_t *engines[8];
+	amd_tool_file_t files[TEST_MAX_CASES];
+	amd_tool_ctx_t ctx;
+	int nengines = 0, e, i, rep;
+
+	for (i = 0; amd_engines[i] && nengines < 8; i++) {
+		if (amd_engines[i] == &amd_model_engine && !amd_model.loaded) {
+			continue;
+		}
+		engines[nengines++] = amd_engines[i];
+	}
+
+	memset(files, 0, sizeof(files));
+	for (i = 0; i < ncases; i++) {
+		if (amd_tool_open(&files[i], cases[i].path, cases[i].rate, cases[i].channels)) {
+			return 1;
+		}
+	}
+	if (amd_tool_ctx_init(&ctx)) {
+		return 1;
+	}
+
+	printf("%-28s %-8s", "file", "expected");
+	for (e = 0; e < nengines; e++) {
+		printf(" %-18s", engines[e]->name);
+	}
+	printf("\n");
+
+	for (i = 0; i < ncases; i++) {
+		printf("%-28s %-8s", cases[i].name, cases[i].status);
+		for (e = 0; e < nengines; e++) {
+			amd_params_t p = cases[i].p;
+			const char *status;
+			amd_tool_result_t r;
+			char cell[32];
+
+			p.engine = engines[e];
+			amd_tool_run(&ctx, &files[i], &p, &defaults, TEST_FRAME_MS, &r);
+			status = amd_verdicts[r.verdict].status ? amd_verdicts[r.verdict].status : "-";
+			snprintf(cell, sizeof(cell), "%s%s@%u", strcmp(status, cases[i].status) ? "*" : "", status, r.decision_ms);
+			printf(" %-18s", cell);
+		}
+		printf("\n");
+	}
+
+	printf("\n%-14s %8s %9s %12s %10s\n", "engine", "correct", "accuracy", "decision_ms", "ns/frame");
+	for (e = 0; e < nengines; e++) {
+		uint64_t decision_ms = 0;
+		double best = -1;
+		int correct = 0, decided = 0;
+
+		/* Verdicts are deterministic; the time is the best of BENCH_REPS passes */
+		for (rep = 0; rep < BENCH_REPS; rep++) {
+			uint64_t ns = 0, frames = 0;
+
+			for (i = 0; i < ncases; i++) {
+				amd_params_t p = cases[i].p;
+				const char *status;
+				amd_tool_result_t r;
+
+				p.engine = engines[e];
+				amd_tool_run(&ctx, &files[i], &p, &defaults, TEST_FRAME_MS, &r);
+				ns += r.ns;
+				frames += r.frames;
+				if (rep) {
+					continue;
+				}
+				status = amd_verdicts[r.verdict].status ? amd_verdicts[r.verdict].status : "-";
+				correct += !strcmp(status, cases[i].status);
+				if (amd_verdicts[r.verdict].status) {
+					decision_ms += r.decision_ms;
+					decided++;
+				}
+			}
+			if (frames && (best < 0 || (double) ns / frames < best)) {
+				best = (double) ns / frames;
+			}
+		}
+
+		printf("%-14s %4d/%-3d %8.1f%% %12.1f %10.1f\n", engines[e]->name, correct, ncases,
+			   ncases ? 100.0 * correct / ncases : 0, decided ? (double) decision_ms / decided : 0, best);
+	}
+
+	amd_tool_ctx_destroy(&ctx);
+	for (i = 0; i < ncases; i++) {
+		amd_tool_close(&files[i]);
+	}
+
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+			"usage: amd_test gen <corpus> <dir>\n"
+			"       amd_test check [-m model] <corpus> <dir>\n"
+			"       amd_test bench [-m model] [-t tolerance] [-u] <corpus> <dir> <expect> <baseline>\n"
+			"       amd_test compare [-m model] <corpus> <dir>\n"
+			"  -m <file>   model file for engine=model entries\n"
+			"  -t <pct>    fail on a ratio this much above the baseline (default: report only)\n"
+			"  -u          rewrite the timing baseline\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *cmd, *model_file = NULL;
+	double tolerance = 0;
+	int update = 0, opt;
+
+	if (argc < 2) {
+		usage();
+		return 2;
+	}
+	cmd = argv[1];
+	optind = 2;
+
+	while ((opt = getopt(argc, argv, "m:t:uh")) != -1) {
+		switch (opt) {
+		case 'm':
+			model_file = optarg;
+			break;
+		case 't':
+			tolerance = atof(optarg);
+			break;
+		case 'u':
+			update = 1;
+			break;
+		default:
+			usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (argc - optind < 2 || (!strcmp(cmd, "bench") && argc - optind < 4)) {
+		usage();
+		return 2;
+	}
+	if (model_file && amd_model_load(model_file, &amd_model)) {
+		return 1;
+	}
+	if (load_corpus(argv[optind], argv[optind + 1])) {
+		return 1;
+	}
+
+	if (!strcmp(cmd, "gen")) {
+		return gen(argv[optind + 1]);
+	} else if (!strcmp(cmd, "check")) {
+		return check();
+	} else if (!strcmp(cmd, "bench")) {
+		return bench(argv[optind + 2], argv[optind + 3], tolerance, update);
+	} else if (!strcmp(cmd, "compare")) {
+		return compare_engines();
+	}
+
+	usage();
+	return 2;
+}
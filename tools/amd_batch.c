@@ -0,0 +1,249 @@
+/*
+ * amd_batch -- rerun the detector over recorded calls
+ *
+ *   amd_batch [-j threads] [-f csv|jsonl] [-o file] [-p params] [-m model]
+ *             [-r rate] [-c channels] [-t frame_ms] <file|dir>...
+ *
+ * Every .wav/.raw/.sln/.pcm file under the given paths is mapped and run
+ * through amd_core with the amd.conf.xml defaults, overridden by -p in
+ * voice_start syntax. Files are handed out to the worker threads one at a
+ * time; each thread owns its hot block and engine state, so workers share
+ * nothing but the next-file counter. Results are written in path order.
+ */
+#include "amd_tool.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+	amd_tool_result_t r;
+	int ok;
+} batch_result_t;
+
+static struct {
+	char **files;
+	size_t count;
+	size_t next;  /* Next file to hand out, taken atomically */
+	batch_result_t *results;
+	amd_params_t params;
+	amd_params_t defaults;
+	uint32_t raw_rate;
+	uint32_t raw_channels;
+	uint32_t frame_ms;
+} batch;
+
+static void *worker(void *arg)
+{
+	amd_tool_ctx_t *ctx = (amd_tool_ctx_t *) arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&batch.next, 1, __ATOMIC_RELAXED)) < batch.count) {
+		amd_tool_file_t f;
+
+		if (amd_tool_open(&f, batch.files[i], batch.raw_rate, batch.raw_channels)) {
+			continue;
+		}
+		if (!amd_tool_run(ctx, &f, &batch.params, &batch.defaults, batch.frame_ms, &batch.results[i].r)) {
+			batch.results[i].ok = 1;
+		}
+		amd_tool_close(&f);
+	}
+
+	return NULL;
+}
+
+static void write_result(FILE *out, int jsonl, const char *path, const amd_tool_result_t *r)
+{
+	const amd_verdict_info_t *v = &amd_verdicts[r->verdict];
+	uint64_t ns_per_frame = r->frames ? r->ns / r->frames : 0;
+
+	if (jsonl) {
+		fputs("{\"file\":", out);
+		amd_tool_json_string(out, path);
+		fprintf(out, ",\"status\":\"%s\",\"result\":\"%s\",\"reason\":\"%s\",\"decision_ms\":%u,\"frames\":%u,\"words\":%u,\"ns_per_frame\":%" PRIu64 "}\n",
+				v->status ? v->status : "", v->result ? v->result : "", v->name,
+				r->decision_ms, r->frames, r->words, ns_per_frame);
+	} else {
+		/* Quote the path only when it needs it */
+		if (strpbrk(path, ",\"\n")) {
+			const char *p;
+
+			fputc('"', out);
+			for (p = path; *p; p++) {
+				if (*p == '"') {
+					fputc('"', out);
+				}
+				fputc(*p, out);
+			}
+			fputc('"', out);
+		} else {
+			fputs(path, out);
+		}
+		fprintf(out, ",%s,%s,%s,%u,%u,%u,%" PRIu64 "\n",
+				v->status ? v->status : "", v->result ? v->result : "", v->name,
+				r->decision_ms, r->frames, r->words, ns_per_frame);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+			"usage: amd_batch [options] <file|dir>...\n"
+			"  -j <threads>   worker threads (default: online CPUs)\n"
+			"  -f csv|jsonl   output format (default: csv)\n"
+			"  -o <file>      output file (default: stdout)\n"
+			"  -p <params>    voice_start style overrides, e.g. engine=gmm,silent_threshold=300\n"
+			"  -m <file>      model file for engine=model\n"
+			"  -r <rate>      sample rate of headerless files (default: 8000)\n"
+			"  -c <channels>  channels of headerless files (default: 1)\n"
+			"  -t <ms>        frame length (default: 20)\n");
+}
+
+int main(int argc, char **argv)
+{
+	amd_params_t defaults = AMD_TOOL_DEFAULTS;
+	const char *format = "csv", *output = NULL, *params = NULL, *model_file = NULL;
+	int threads = 0, jsonl, opt, i, failed = 0;
+	amd_tool_ctx_t *ctxs;
+	pthread_t *tids;
+	uint64_t start, wall_ns, cpu_ns = 0, frames = 0, audio_ms = 0;
+	const amd_engine_t *requested, *used = NULL;
+	int fallbacks = 0;
+	char engine[64];
+	FILE *out = stdout;
+	size_t n;
+
+	batch.raw_rate = 8000;
+	batch.raw_channels = 1;
+	batch.frame_ms = 20;
+
+	while ((opt = getopt(argc, argv, "j:f:o:p:m:r:c:t:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'f':
+			format = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'p':
+			params = optarg;
+			break;
+		case 'm':
+			model_file = optarg;
+			break;
+		case 'r':
+			batch.raw_rate = (uint32_t) atoi(optarg);
+			break;
+		case 'c':
+			batch.raw_channels = (uint32_t) atoi(optarg);
+			break;
+		case 't':
+			batch.frame_ms = (uint32_t) atoi(optarg);
+			break;
+		default:
+			usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (optind >= argc || (strcmp(format, "csv") && strcmp(format, "jsonl")) || !batch.frame_ms) {
+		usage();
+		return 2;
+	}
+	jsonl = !strcmp(format, "jsonl");
+
+	if (model_file && amd_model_load(model_file, &amd_model)) {
+		return 1;
+	}
+
+	batch.defaults = defaults;
+	amd_params_parse(&batch.params, params, NULL);
+	requested = batch.params.engine ? batch.params.engine : (defaults.engine ? defaults.engine : &amd_energy_engine);
+
+	if (amd_tool_collect(argv + optind, argc - optind, &batch.files, &batch.count)) {
+		return 1;
+	}
+	if (!batch.count) {
+		fprintf(stderr, "amd_batch: no audio files found\n");
+		return 1;
+	}
+
+	if (threads <= 0) {
+		threads = amd_tool_cpus();
+	}
+	if ((size_t) threads > batch.count) {
+		threads = (int) batch.count;
+	}
+
+	batch.results = calloc(batch.count, sizeof(batch_result_t));
+	ctxs = calloc((size_t) threads, sizeof(amd_tool_ctx_t));
+	tids = calloc((size_t) threads, sizeof(pthread_t));
+	if (!batch.results || !ctxs || !tids) {
+		fprintf(stderr, "amd_batch: out of memory\n");
+		return 1;
+	}
+
+	start = amd_now_ns();
+	for (i = 0; i < threads; i++) {
+		if (amd_tool_ctx_init(&ctxs[i]) || pthread_create(&tids[i], NULL, worker, &ctxs[i])) {
+			fprintf(stderr, "amd_batch: cannot start worker %d\n", i);
+			return 1;
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+		amd_tool_ctx_destroy(&ctxs[i]);
+	}
+	wall_ns = amd_now_ns() - start;
+
+	if (output && !(out = fopen(output, "w"))) {
+		perror(output);
+		return 1;
+	}
+	if (!jsonl) {
+		fputs("file,status,result,reason,decision_ms,frames,words,ns_per_frame\n", out);
+	}
+	for (n = 0; n < batch.count; n++) {
+		if (!batch.results[n].ok) {
+			failed++;
+			continue;
+		}
+		write_result(out, jsonl, batch.files[n], &batch.results[n].r);
+		cpu_ns += batch.results[n].r.ns;
+		frames += batch.results[n].r.frames;
+		audio_ms += batch.results[n].r.decision_ms;
+		used = batch.results[n].r.engine;
+		fallbacks += used != requested;
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	/* Name the engine that ran, not the one asked for */
+	snprintf(engine, sizeof(engine), "%s", used ? used->name : requested->name);
+	if (fallbacks && fallbacks < (int) batch.count - failed) {
+		snprintf(engine, sizeof(engine), "%s (%s on %d files)", requested->name, amd_energy_engine.name, fallbacks);
+	}
+
+	fprintf(stderr,
+			"amd_batch: engine %s, %zu files (%d failed), %d threads, %.1f s audio in %.3f s: "
+			"%.0f calls/s, %.0f calls/s/thread, %" PRIu64 " ns/frame\n",
+			engine,
+			batch.count, failed, threads, audio_ms / 1000.0, wall_ns / 1e9,
+			(batch.count - failed) / (wall_ns / 1e9),
+			(batch.count - failed) / (wall_ns / 1e9) / threads,
+			frames ? cpu_ns / frames : 0);
+
+	amd_tool_free_list(batch.files, batch.count);
+	free(batch.results);
+	free(ctxs);
+	free(tids);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,474 @@
+/*
+ * amd_tool.c -- shared code for the offline tools
+ */
+#include "amd_tool.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+/* Detector messages (debug=1, model errors) go to stderr, tagged with the file */
+void amd_core_log(const void *owner, amd_log_level_t level, const char *fmt, ...)
+{
+	const amd_tool_file_t *f = (const amd_tool_file_t *) owner;
+	char msg[512];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+
+	if (f) {
+		fprintf(stderr, "%s: %s", f->path, msg);
+	} else {
+		fputs(msg, stderr);
+	}
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+	return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* Find the fmt and data chunks of a RIFF/WAVE file */
+static int parse_wav(amd_tool_file_t *f)
+{
+	const uint8_t *p = (const uint8_t *) f->map, *end = p + f->map_len;
+	int have_fmt = 0;
+
+	if (f->map_len < 12 || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4)) {
+		return -1;
+	}
+
+	for (p += 12; p + 8 <= end; ) {
+		uint32_t len = le32(p + 4);
+		const uint8_t *body = p + 8;
+
+		if (!memcmp(p, "fmt ", 4) && len >= 16 && body + 16 <= end) {
+			uint16_t format = le16(body), bits = le16(body + 14);
+
+			/* WAVE_FORMAT_EXTENSIBLE: the real format leads the subformat GUID */
+			if (format == 0xFFFE && len >= 26 && body + 26 <= end) {
+				format = le16(body + 24);
+			}
+
+			f->channels = le16(body + 2);
+			f->rate = le32(body + 4);
+			if (format == 1 && bits == 16) {
+				f->encoding = AMD_TOOL_PCM16;
+			} else if (format == 7 && bits == 8) {
+				f->encoding = AMD_TOOL_ULAW;
+			} else if (format == 6 && bits == 8) {
+				f->encoding = AMD_TOOL_ALAW;
+			} else {
+				fprintf(stderr, "%s: unsupported WAV format %u/%u bits\n", f->path, format, bits);
+				return -1;
+			}
+			have_fmt = 1;
+		} else if (!memcmp(p, "data", 4) && have_fmt) {
+			f->data = body;
+			/* Recordings still being written carry a bogus length */
+			f->bytes = len <= (size_t) (end - body) ? len : (size_t) (end - body);
+			return 0;
+		}
+
+		if ((size_t) (end - body) < len) {
+			break;
+		}
+		p = body + len + (len & 1);
+	}
+
+	return -1;
+}
+
+int amd_tool_open(amd_tool_file_t *f, const char *path, uint32_t raw_rate, uint32_t raw_channels)
+{
+	const char *ext = strrchr(path, '.');
+	struct stat st;
+	int fd;
+
+	memset(f, 0, sizeof(*f));
+	f->path = path;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		fprintf(stderr, "%s: empty or unreadable\n", path);
+		return -1;
+	}
+
+	f->map_len = (size_t) st.st_size;
+	/* Fault the file in up front so the frame loop times only the detector */
+	f->map = mmap(NULL, f->map_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (f->map == MAP_FAILED) {
+		f->map = NULL;
+		fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (ext && !strcasecmp(ext, ".wav")) {
+		if (parse_wav(f)) {
+			fprintf(stderr, "%s: not a supported WAV file\n", path);
+			amd_tool_close(f);
+			return -1;
+		}
+	} else {
+		f->data = (const uint8_t *) f->map;
+		f->bytes = f->map_len;
+		f->rate = raw_rate;
+		f->channels = raw_channels;
+		f->encoding = AMD_TOOL_PCM16;
+	}
+
+	if (f->rate < 8000 || f->rate > 48000 || f->channels < 1 || f->channels > 2) {
+		fprintf(stderr, "%s: unsupported audio (%u Hz, %u channels)\n", path, f->rate, f->channels);
+		amd_tool_close(f);
+		return -1;
+	}
+
+	return 0;
+}
+
+void amd_tool_close(amd_tool_file_t *f)
+{
+	if (f->map) {
+		munmap(f->map, f->map_len);
+		f->map = NULL;
+	}
+}
+
+static uint32_t frame_samples(const amd_tool_file_t *f, uint32_t frame_ms)
+{
+	return f->rate * frame_ms / 1000;
+}
+
+static uint32_t sample_bytes(const amd_tool_file_t *f)
+{
+	return f->encoding == AMD_TOOL_PCM16 ? 2 : 1;
+}
+
+uint32_t amd_tool_frames(const amd_tool_file_t *f, uint32_t frame_ms)
+{
+	uint32_t spf = frame_samples(f, frame_ms);
+
+	if (!spf || spf * f->channels > AMD_TOOL_MAX_FRAME) {
+		return 0;
+	}
+
+	return (uint32_t) (f->bytes / ((size_t) spf * f->channels * sample_bytes(f)));
+}
+
+/* G.711 expansion, as in ITU-T G.711 / the classic Sun reference code */
+static int16_t ulaw_decode(uint8_t u)
+{
+	int t;
+
+	u = ~u;
+	t = ((u & 0x0F) << 3) + 0x84;
+	t <<= (u & 0x70) >> 4;
+
+	return (int16_t) ((u & 0x80) ? (0x84 - t) : (t - 0x84));
+}
+
+static int16_t alaw_decode(uint8_t a)
+{
+	int t, seg;
+
+	a ^= 0x55;
+	t = (a & 0x0F) << 4;
+	seg = (a & 0x70) >> 4;
+	if (seg == 0) {
+		t += 8;
+	} else {
+		t = (t + 0x108) << (seg - 1);
+	}
+
+	return (int16_t) ((a & 0x80) ? t : -t);
+}
+
+void amd_tool_frame(const amd_tool_file_t *f, uint32_t frame_ms, uint32_t n, int16_t *buf, amd_pcm_t *pcm)
+{
+	uint32_t spf = frame_samples(f, frame_ms), count = spf * f->channels, i;
+	const uint8_t *src = f->data + (size_t) n * count * sample_bytes(f);
+
+	pcm->samples = spf;
+	pcm->channels = f->channels;
+	pcm->rate = f->rate;
+
+	switch (f->encoding) {
+	case AMD_TOOL_PCM16:
+		/* Straight out of the mapping unless the data chunk is misaligned */
+		if (!((uintptr_t) src & 1)) {
+			pcm->data = (const int16_t *) src;
+			return;
+		}
+		memcpy(buf, src, count * 2);
+		break;
+	case AMD_TOOL_ULAW:
+		for (i = 0; i < count; i++) {
+			buf[i] = ulaw_decode(src[i]);
+		}
+		break;
+	case AMD_TOOL_ALAW:
+		for (i = 0; i < count; i++) {
+			buf[i] = alaw_decode(src[i]);
+		}
+		break;
+	}
+
+	pcm->data = buf;
+}
+
+int amd_tool_ctx_init(amd_tool_ctx_t *ctx)
+{
+	size_t len = 0;
+	int i;
+
+	memset(ctx, 0, sizeof(*ctx));
+
+	for (i = 0; amd_engines[i]; i++) {
+		if (amd_engines[i]->footprint() > len) {
+			len = amd_engines[i]->footprint();
+		}
+	}
+
+	if (posix_memalign((void **) &ctx->hot, 64, sizeof(amd_vad_hot_t))) {
+		return -1;
+	}
+	if (len && posix_memalign(&ctx->engine_state, 64, len)) {
+		free(ctx->hot);
+		return -1;
+	}
+	ctx->engine_state_len = len;
+
+	return 0;
+}
+
+void amd_tool_ctx_destroy(amd_tool_ctx_t *ctx)
+{
+	free(ctx->hot);
+	free(ctx->engine_state);
+}
+
+uint64_t amd_tool_thread_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Same steps as amd_process_read, minus events, fingerprints and load shedding */
+int amd_tool_run(amd_tool_ctx_t *ctx, const amd_tool_file_t *f, const amd_params_t *params,
+				 const amd_params_t *defaults, uint32_t frame_ms, amd_tool_result_t *r)
+{
+	amd_vad_hot_t *hot = ctx->hot;
+	const amd_engine_t *engine = params->engine ? params->engine : (defaults->engine ? defaults->engine : &amd_energy_engine);
+	uint32_t frames = amd_tool_frames(f, frame_ms), n;
+	amd_verdict_t verdict = AMD_VERDICT_NONE;
+	amd_frame_classifier frame_type;
+	amd_pcm_t pcm;
+	uint64_t start;
+
+	memset(hot, 0, sizeof(*hot));
+	hot->state = AMD_SM_INITIAL_SILENCE;
+	hot->owner = f;
+	amd_resolve_params(hot, params, defaults);
+
+	/* Our side is only there in a stereo recording */
+	if (f->channels < 2) {
+		hot->dual = 0;
+	}
+
+	if (ctx->engine_state) {
+		memset(ctx->engine_state, 0, ctx->engine_state_len);
+	}
+	if (engine->init(hot, ctx->engine_state)) {
+		engine = &amd_energy_engine;
+		engine->init(hot, ctx->engine_state);
+	}
+
+	start = amd_tool_thread_ns();
+	for (n = 0; n < frames; n++) {
+		amd_tool_frame(f, frame_ms, n, ctx->buf, &pcm);
+
+		if ((verdict = amd_advance(hot, &pcm)) != AMD_VERDICT_NONE) {
+			break;
+		}
+
+		hot->frames++;
+		frame_type = amd_engine_frame(hot, engine, ctx->engine_state, &pcm, &verdict);
+		if (verdict != AMD_VERDICT_NONE) {
+			break;
+		}
+
+		if ((verdict = amd_step(hot, frame_type)) != AMD_VERDICT_NONE) {
+			break;
+		}
+	}
+	engine->finish(hot, ctx->engine_state);
+
+	r->ns = amd_tool_thread_ns() - start;
+	r->verdict = verdict;
+	r->decision_ms = hot->total_duration;
+	r->frames = hot->frames;
+	r->words = hot->words;
+	r->engine = engine;
+
+	return 0;
+}
+
+static int wanted(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+
+	return ext && (!strcasecmp(ext, ".wav") || !strcasecmp(ext, ".raw") ||
+				   !strcasecmp(ext, ".sln") || !strcasecmp(ext, ".pcm"));
+}
+
+static int push(char ***list, size_t *count, size_t *cap, const char *path)
+{
+	if (*count == *cap) {
+		size_t ncap = *cap ? *cap * 2 : 256;
+		char **nlist = realloc(*list, ncap * sizeof(char *));
+
+		if (!nlist) {
+			return -1;
+		}
+		*list = nlist;
+		*cap = ncap;
+	}
+
+	if (!((*list)[*count] = strdup(path))) {
+		return -1;
+	}
+	(*count)++;
+
+	return 0;
+}
+
+static int walk(const char *dir, char ***list, size_t *count, size_t *cap)
+{
+	DIR *d;
+	struct dirent *de;
+	int rc = 0;
+
+	if (!(d = opendir(dir))) {
+		fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+
+	while (!rc && (de = readdir(d))) {
+		char path[4096];
+		struct stat st;
+
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (stat(path, &st) < 0) {
+			continue;
+		}
+
+		if (S_ISDIR(st.st_mode)) {
+			rc = walk(path, list, count, cap);
+		} else if (S_ISREG(st.st_mode) && wanted(de->d_name)) {
+			rc = push(list, count, cap, path);
+		}
+	}
+	closedir(d);
+
+	return rc;
+}
+
+static int cmp_path(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+int amd_tool_collect(char **paths, int npaths, char ***list, size_t *count)
+{
+	size_t cap = 0;
+	int i;
+
+	*list = NULL;
+	*count = 0;
+
+	for (i = 0; i < npaths; i++) {
+		struct stat st;
+
+		if (stat(paths[i], &st) < 0) {
+			fprintf(stderr, "%s: %s\n", paths[i], strerror(errno));
+			goto fail;
+		}
+		if (S_ISDIR(st.st_mode) ? walk(paths[i], list, count, &cap) : push(list, count, &cap, paths[i])) {
+			goto fail;
+		}
+	}
+
+	if (*count) {
+		qsort(*list, *count, sizeof(char *), cmp_path);
+	}
+	return 0;
+
+fail:
+	amd_tool_free_list(*list, *count);
+	*list = NULL;
+	*count = 0;
+	return -1;
+}
+
+void amd_tool_free_list(char **list, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		free(list[i]);
+	}
+	free(list);
+}
+
+int amd_tool_cpus(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (int) n : 1;
+}
+
+void amd_tool_json_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s; s++) {
+		unsigned char c = (unsigned char) *s;
+
+		if (c == '"' || c == '\\') {
+			fputc('\\', out);
+			fputc(c, out);
+		} else if (c < 0x20) {
+			fprintf(out, "\\u%04x", c);
+		} else {
+			fputc(c, out);
+		}
+	}
+	fputc('"', out);
+}
@@ -0,0 +1,107 @@
+/*
+ * amd_tool.h -- shared code for the offline tools
+ *
+ * Recorded calls are mapped read-only and fed to amd_core frame by frame,
+ * in the same order of steps as the module's READ callback.
+ */
+#ifndef AMD_TOOL_H
+#define AMD_TOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "amd_core.h"
+
+/* amd.conf.xml defaults, as in the module's config table */
+#define AMD_TOOL_DEFAULTS { \
+	256,   /* silent_threshold */ \
+	4500,  /* silent_initial */ \
+	1000,  /* silent_after_intro */ \
+	200,   /* silent_max_session */ \
+	1250,  /* noise_max_intro */ \
+	120,   /* noise_min_length */ \
+	30,    /* noise_inter_silence */ \
+	6,     /* noise_max_count */ \
+	5000,  /* total_analysis_time */ \
+	0,     /* debug */ \
+	0,     /* dual */ \
+	1000,  /* response_window */ \
+	500,   /* prompt_min_length */ \
+	NULL   /* engine */ \
+}
+
+typedef enum {
+	AMD_TOOL_PCM16,
+	AMD_TOOL_ULAW,
+	AMD_TOOL_ALAW
+} amd_tool_encoding_t;
+
+/* A mapped recording */
+typedef struct {
+	const char *path;
+	void *map;
+	size_t map_len;
+	const uint8_t *data;  /* First sample */
+	size_t bytes;
+	uint32_t rate;
+	uint32_t channels;
+	amd_tool_encoding_t encoding;
+} amd_tool_file_t;
+
+/* Open a .wav (PCM16, mu-law or A-law) or headerless L16 file of raw_rate/raw_channels */
+int amd_tool_open(amd_tool_file_t *f, const char *path, uint32_t raw_rate, uint32_t raw_channels);
+void amd_tool_close(amd_tool_file_t *f);
+
+/* Frames of frame_ms in the file */
+uint32_t amd_tool_frames(const amd_tool_file_t *f, uint32_t frame_ms);
+
+/*
+ * Point pcm at frame n of the file, decoding into buf when needed. buf
+ * holds at least AMD_TOOL_MAX_FRAME samples.
+ */
+#define AMD_TOOL_MAX_FRAME (48000 / 10 * 2)  /* 100ms of 48kHz stereo */
+void amd_tool_frame(const amd_tool_file_t *f, uint32_t frame_ms, uint32_t n, int16_t *buf, amd_pcm_t *pcm);
+
+/* Outcome of one detection */
+typedef struct {
+	amd_verdict_t verdict;  /* AMD_VERDICT_NONE if the audio ran out first */
+	uint32_t decision_ms;  /* Audio time at the verdict, or the length analyzed */
+	uint32_t frames;  /* Frames classified */
+	uint32_t words;
+	uint64_t ns;  /* Thread CPU time spent in the detector */
+	const amd_engine_t *engine;  /* Engine that ran: energy if the requested one failed to initialize */
+} amd_tool_result_t;
+
+/*
+ * Per-thread scratch for amd_tool_run: a cache-line aligned hot block and
+ * engine state large enough for any engine.
+ */
+typedef struct {
+	amd_vad_hot_t *hot;
+	void *engine_state;
+	size_t engine_state_len;
+	int16_t buf[AMD_TOOL_MAX_FRAME];
+} amd_tool_ctx_t;
+
+int amd_tool_ctx_init(amd_tool_ctx_t *ctx);
+void amd_tool_ctx_destroy(amd_tool_ctx_t *ctx);
+
+/* Run a detection over the file with the given per-call params */
+int amd_tool_run(amd_tool_ctx_t *ctx, const amd_tool_file_t *f, const amd_params_t *params,
+				 const amd_params_t *defaults, uint32_t frame_ms, amd_tool_result_t *r);
+
+/* Files under each path (recursing into directories), sorted; free with amd_tool_free_list */
+int amd_tool_collect(char **paths, int npaths, char ***list, size_t *count);
+void amd_tool_free_list(char **list, size_t count);
+
+/* CPU time of the calling thread, so busy neighbours don't inflate ns/frame */
+uint64_t amd_tool_thread_ns(void);
+
+/* Worker threads to use when not given: online CPUs */
+int amd_tool_cpus(void);
+
+/* Write s as a JSON string literal */
+void amd_tool_json_string(FILE *out, const char *s);
+
+#endif
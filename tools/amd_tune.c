@@ -0,0 +1,772 @@
+/*
+ * amd_tune -- search amd.conf.xml parameters against a labeled corpus
+ *
+ *   amd_tune [-j threads] [-l labels.csv] [-p params] [-g name=spec]...
+ *            [-n random] [-S seed] [-k top] [-r rate] [-c channels]
+ *            [-t frame_ms] <file|dir>...
+ *
+ * Each recording is decoded and scored once: the energy score of both
+ * channels per frame, and the gmm decision when engine=gmm (it does not
+ * depend on any threshold). A candidate then only replays the decision
+ * state machine over those scores, so thousands of candidates cost about
+ * as much as one pass of real classification.
+ *
+ * Labels come from -l (lines of "path,machine|human") or, failing that,
+ * from a path component named machine, human or person.
+ */
+#include "amd_tool.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+/* Parameters that can be searched, by offset into amd_params_t */
+static const struct {
+	const char *name;
+	size_t offset;
+} tunables[] = {
+	{ "silent_threshold", offsetof(amd_params_t, silent_threshold) },
+	{ "silent_initial", offsetof(amd_params_t, silent_initial) },
+	{ "silent_after_intro", offsetof(amd_params_t, silent_after_intro) },
+	{ "silent_max_session", offsetof(amd_params_t, silent_max_session) },
+	{ "noise_max_intro", offsetof(amd_params_t, noise_max_intro) },
+	{ "noise_min_length", offsetof(amd_params_t, noise_min_length) },
+	{ "noise_inter_silence", offsetof(amd_params_t, noise_inter_silence) },
+	{ "noise_max_count", offsetof(amd_params_t, noise_max_count) },
+	{ "total_analysis_time", offsetof(amd_params_t, total_analysis_time) },
+	{ "dual", offsetof(amd_params_t, dual) },
+	{ "response_window", offsetof(amd_params_t, response_window) },
+	{ "prompt_min_length", offsetof(amd_params_t, prompt_min_length) }
+};
+
+#define TUNABLES (sizeof(tunables) / sizeof(tunables[0]))
+#define PARAM(p, i) (*(uint32_t *) ((char *) (p) + tunables[i].offset))
+#define RESOLVED(p, i) (PARAM(p, i) ? PARAM(p, i) : PARAM(&tune.defaults, i))
+
+/* Values to try for one parameter */
+typedef struct {
+	int tunable;
+	uint32_t *values;
+	uint32_t count;
+} axis_t;
+
+/* Per-frame data of one recording, precomputed once */
+typedef struct {
+	const char *path;
+	int machine;
+	uint32_t rate;
+	uint32_t samples;  /* Per frame, per channel */
+	uint32_t stereo:1;
+	uint32_t frames;
+	uint32_t *score;  /* Callee energy score */
+	uint32_t *write_score;  /* Our side, stereo only */
+	uint8_t *voiced;  /* gmm decision, engine=gmm only */
+} corpus_file_t;
+
+typedef struct {
+	uint64_t index;  /* Candidate number, UINT64_MAX for the baseline */
+	double f1;
+	double precision;
+	double recall;
+	double accuracy;
+	double latency_ms;
+	uint32_t undecided;
+} score_t;
+
+static struct {
+	corpus_file_t *files;
+	size_t count;
+	size_t next;
+	amd_params_t base;
+	amd_params_t defaults;
+	axis_t axes[TUNABLES];
+	int naxes;
+	uint64_t candidates;
+	uint64_t random;  /* Random draws instead of the full grid when non-zero */
+	uint64_t seed;
+	uint32_t frame_ms;
+	uint32_t max_frames;
+	uint32_t raw_rate;
+	uint32_t raw_channels;
+	int top;
+	int gmm;
+} tune;
+
+/* Per-thread best candidates */
+typedef struct {
+	amd_tool_ctx_t ctx;
+	score_t *best;
+	int nbest;
+} worker_t;
+
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+/* Parameters of candidate n: grid position in mixed radix, or a seeded draw */
+static void candidate(uint64_t n, amd_params_t *p)
+{
+	uint64_t rest = n, rng = splitmix64(tune.seed ^ n);
+	int a;
+
+	*p = tune.base;
+	if (n == UINT64_MAX) {
+		return;
+	}
+
+	for (a = 0; a < tune.naxes; a++) {
+		const axis_t *ax = &tune.axes[a];
+		uint32_t v;
+
+		if (tune.random) {
+			rng = splitmix64(rng);
+			v = (uint32_t) (rng % ax->count);
+		} else {
+			v = (uint32_t) (rest % ax->count);
+			rest /= ax->count;
+		}
+		PARAM(p, ax->tunable) = ax->values[v];
+	}
+}
+
+/* Unsigned decimal at *p, which is left after its last digit */
+static int parse_value(const char **p, uint32_t *v)
+{
+	unsigned long n;
+	char *end;
+
+	if (**p < '0' || **p > '9') {
+		return -1;
+	}
+	errno = 0;
+	n = strtoul(*p, &end, 10);
+	if (errno || n > UINT32_MAX) {
+		return -1;
+	}
+	*v = (uint32_t) n;
+	*p = end;
+	return 0;
+}
+
+/* name=lo:hi:step, name=v1|v2|..., or name=v */
+static int parse_axis(const char *spec)
+{
+	const char *eq = strchr(spec, '=');
+	axis_t *ax = &tune.axes[tune.naxes];
+	uint32_t lo, hi, step;
+	size_t i;
+
+	if (!eq || tune.naxes == (int) TUNABLES) {
+		return -1;
+	}
+
+	ax->tunable = -1;
+	for (i = 0; i < TUNABLES; i++) {
+		if (!strncasecmp(spec, tunables[i].name, (size_t) (eq - spec)) && strlen(tunables[i].name) == (size_t) (eq - spec)) {
+			ax->tunable = (int) i;
+		}
+	}
+	if (ax->tunable < 0) {
+		fprintf(stderr, "amd_tune: unknown parameter in '%s'\n", spec);
+		return -1;
+	}
+
+	eq++;
+	if (strchr(eq, ':')) {
+		const char *p = eq;
+
+		/* Exactly three fields, nothing after them */
+		if (parse_value(&p, &lo) || *p++ != ':' || parse_value(&p, &hi) || *p++ != ':' ||
+			parse_value(&p, &step) || *p || !step || hi < lo) {
+			return -1;
+		}
+		ax->count = (hi - lo) / step + 1;
+		ax->values = calloc(ax->count, sizeof(uint32_t));
+		for (i = 0; i < ax->count; i++) {
+			ax->values[i] = lo + (uint32_t) i * step;
+		}
+	} else {
+		const char *p;
+
+		for (ax->count = 1, p = eq; *p; p++) {
+			ax->count += *p == '|';
+		}
+		ax->values = calloc(ax->count, sizeof(uint32_t));
+		for (i = 0, p = eq; i < ax->count; i++) {
+			/* Each value runs up to the next '|' or the end */
+			if (parse_value(&p, &ax->values[i]) || (*p && *p != '|')) {
+				free(ax->values);
+				ax->values = NULL;
+				return -1;
+			}
+			p += *p == '|';
+		}
+	}
+
+	tune.naxes++;
+	return 0;
+}
+
+/* 1 machine, 0 human, -1 unknown */
+static int label_from_path(const char *path)
+{
+	const char *p = path;
+
+	while (p && *p) {
+		const char *end = strchr(p, '/');
+		size_t len = end ? (size_t) (end - p) : strlen(p);
+
+		if (len == 7 && !strncasecmp(p, "machine", 7)) {
+			return 1;
+		}
+		if ((len == 5 && !strncasecmp(p, "human", 5)) || (len == 6 && !strncasecmp(p, "person", 6))) {
+			return 0;
+		}
+		p = end ? end + 1 : NULL;
+	}
+
+	return -1;
+}
+
+/* One line of the -l file */
+typedef struct {
+	char *path;
+	int machine;
+	size_t line;  /* Earlier lines win for a path listed twice */
+} label_t;
+
+static int label_cmp(const void *a, const void *b)
+{
+	const label_t *la = a, *lb = b;
+	int c = strcmp(la->path, lb->path);
+
+	return c ? c : (la->line > lb->line) - (la->line < lb->line);
+}
+
+static int label_path_cmp(const void *a, const void *b)
+{
+	return strcmp(((const label_t *) a)->path, ((const label_t *) b)->path);
+}
+
+/* Read the labels file once, sorted by path for label_from_file */
+static int load_labels(const char *file, label_t **labels, size_t *count)
+{
+	FILE *fp = fopen(file, "r");
+	char line[4096];
+	size_t cap = 0, n = 0, i, lineno = 0;
+	label_t *l = NULL;
+
+	if (!fp) {
+		fprintf(stderr, "amd_tune: %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *comma = strrchr(line, ',');
+		int machine;
+
+		lineno++;
+		if (line[0] == '#' || !comma) {
+			continue;
+		}
+		*comma++ = '\0';
+		comma[strcspn(comma, " \t\r\n")] = '\0';
+		machine = !strcasecmp(comma, "machine") ? 1 : ((!strcasecmp(comma, "human") || !strcasecmp(comma, "person")) ? 0 : -1);
+		if (machine < 0) {
+			continue;
+		}
+
+		if (n == cap) {
+			label_t *nl;
+
+			cap = cap ? cap * 2 : 256;
+			if (!(nl = realloc(l, cap * sizeof(label_t)))) {
+				fclose(fp);
+				return -1;
+			}
+			l = nl;
+		}
+		l[n].path = strdup(line);
+		l[n].machine = machine;
+		l[n].line = lineno;
+		n++;
+	}
+	fclose(fp);
+
+	if (n) {
+		qsort(l, n, sizeof(label_t), label_cmp);
+	}
+	for (i = 0, *count = 0; i < n; i++) {
+		if (*count && !strcmp(l[*count - 1].path, l[i].path)) {
+			free(l[i].path);
+			continue;
+		}
+		l[(*count)++] = l[i];
+	}
+	*labels = l;
+
+	return 0;
+}
+
+static int label_from_file(const label_t *labels, size_t count, const char *path)
+{
+	label_t key = { (char *) path, 0, 0 };
+	const label_t *l;
+
+	if (!count) {
+		return -1;
+	}
+	l = bsearch(&key, labels, count, sizeof(label_t), label_path_cmp);
+
+	return l ? l->machine : -1;
+}
+
+/* Score every frame of a file, up to the longest total_analysis_time searched */
+static int precompute(amd_tool_ctx_t *ctx, corpus_file_t *cf)
+{
+	amd_tool_file_t f;
+	amd_pcm_t pcm;
+	uint32_t n;
+
+	if (amd_tool_open(&f, cf->path, tune.raw_rate, tune.raw_channels)) {
+		return -1;
+	}
+
+	cf->rate = f.rate;
+	cf->samples = f.rate * tune.frame_ms / 1000;
+	cf->stereo = f.channels > 1;
+	cf->frames = amd_tool_frames(&f, tune.frame_ms);
+	if (cf->frames > tune.max_frames) {
+		cf->frames = tune.max_frames;
+	}
+
+	cf->score = calloc(cf->frames + 1, sizeof(uint32_t));
+	cf->write_score = cf->stereo ? calloc(cf->frames + 1, sizeof(uint32_t)) : NULL;
+	cf->voiced = tune.gmm ? calloc(cf->frames + 1, 1) : NULL;
+
+	if (tune.gmm) {
+		memset(ctx->engine_state, 0, ctx->engine_state_len);
+		memset(ctx->hot, 0, sizeof(*ctx->hot));
+		amd_gmm_engine.init(ctx->hot, ctx->engine_state);
+	}
+
+	for (n = 0; n < cf->frames; n++) {
+		amd_verdict_t verdict;
+
+		amd_tool_frame(&f, tune.frame_ms, n, ctx->buf, &pcm);
+		cf->score[n] = amd_frame_score(&pcm, cf->stereo ? &cf->write_score[n] : NULL);
+		if (tune.gmm) {
+			cf->voiced[n] = amd_gmm_engine.process_frame(ctx->hot, ctx->engine_state, &pcm, &verdict) == VOICED;
+		}
+	}
+
+	amd_tool_close(&f);
+	return 0;
+}
+
+static void *precompute_worker(void *arg)
+{
+	amd_tool_ctx_t *ctx = (amd_tool_ctx_t *) arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&tune.next, 1, __ATOMIC_RELAXED)) < tune.count) {
+		if (precompute(ctx, &tune.files[i])) {
+			tune.files[i].frames = 0;
+		}
+	}
+
+	return NULL;
+}
+
+/* Replay the state machine over the stored scores, as amd_tool_run would */
+static amd_verdict_t replay(amd_vad_hot_t *hot, const corpus_file_t *cf, const amd_params_t *p)
+{
+	amd_pcm_t pcm = { NULL, cf->samples, cf->stereo ? 2 : 1, cf->rate };
+	amd_verdict_t verdict;
+	uint32_t n;
+
+	memset(hot, 0, sizeof(*hot));
+	hot->state = AMD_SM_INITIAL_SILENCE;
+	amd_resolve_params(hot, p, &tune.defaults);
+	if (!cf->stereo) {
+		hot->dual = 0;
+	}
+
+	for (n = 0; n < cf->frames; n++) {
+		amd_frame_classifier frame_type;
+
+		if ((verdict = amd_advance(hot, &pcm)) != AMD_VERDICT_NONE) {
+			return verdict;
+		}
+
+		hot->frames++;
+		if (hot->dual) {
+			hot->write_score = cf->write_score[n];
+		}
+		if (cf->voiced) {
+			frame_type = cf->voiced[n] ? VOICED : SILENCE;
+		} else {
+			frame_type = cf->score[n] >= hot->silent_threshold ? VOICED : SILENCE;
+		}
+
+		if ((verdict = amd_step(hot, frame_type)) != AMD_VERDICT_NONE) {
+			return verdict;
+		}
+	}
+
+	return AMD_VERDICT_NONE;
+}
+
+static void evaluate(amd_vad_hot_t *hot, uint64_t index, score_t *s)
+{
+	uint32_t tp = 0, fp = 0, fn = 0, tn = 0, decided = 0, total = 0;
+	uint64_t latency = 0;
+	amd_params_t p;
+	size_t i;
+
+	candidate(index, &p);
+	memset(s, 0, sizeof(*s));
+	s->index = index;
+
+	for (i = 0; i < tune.count; i++) {
+		const corpus_file_t *cf = &tune.files[i];
+		const char *status;
+
+		if (!cf->frames) {
+			continue;
+		}
+		total++;
+
+		status = amd_verdicts[replay(hot, cf, &p)].status;
+		if (!status) {
+			s->undecided++;
+			status = "";
+		} else if (strcmp(status, "unsure")) {
+			decided++;
+			latency += hot->total_duration;
+		}
+
+		if (!strcmp(status, "machine")) {
+			cf->machine ? tp++ : fp++;
+		} else if (cf->machine) {
+			fn++;
+		} else if (!strcmp(status, "person")) {
+			tn++;
+		}
+	}
+
+	s->precision = tp + fp ? (double) tp / (tp + fp) : 0;
+	s->recall = tp + fn ? (double) tp / (tp + fn) : 0;
+	s->f1 = s->precision + s->recall > 0 ? 2 * s->precision * s->recall / (s->precision + s->recall) : 0;
+	s->accuracy = total ? (double) (tp + tn) / total : 0;
+	s->latency_ms = decided ? (double) latency / decided : 0;
+}
+
+/* Higher F1 first, then lower latency */
+static int better(const score_t *a, const score_t *b)
+{
+	if (a->f1 != b->f1) {
+		return a->f1 > b->f1;
+	}
+	return a->latency_ms < b->latency_ms;
+}
+
+static void keep(score_t *best, int *nbest, int top, const score_t *s)
+{
+	int i = *nbest < top ? (*nbest)++ : top - 1;
+
+	if (i == top - 1 && *nbest == top && !better(s, &best[i])) {
+		return;
+	}
+	for (; i > 0 && better(s, &best[i - 1]); i--) {
+		best[i] = best[i - 1];
+	}
+	best[i] = *s;
+}
+
+static void *search_worker(void *arg)
+{
+	worker_t *w = (worker_t *) arg;
+	uint64_t n;
+	score_t s;
+
+	while ((n = __atomic_fetch_add(&tune.next, 1, __ATOMIC_RELAXED)) < tune.candidates) {
+		evaluate(w->ctx.hot, n, &s);
+		keep(w->best, &w->nbest, tune.top, &s);
+	}
+
+	return NULL;
+}
+
+static void print_score(const char *rank, const score_t *s)
+{
+	amd_params_t p;
+	int a;
+
+	candidate(s->index, &p);
+	printf("%-8s f1=%.4f precision=%.4f recall=%.4f accuracy=%.4f latency_ms=%.0f undecided=%u",
+		   rank, s->f1, s->precision, s->recall, s->accuracy, s->latency_ms, s->undecided);
+	for (a = 0; a < tune.naxes; a++) {
+		printf(" %s=%u", tunables[tune.axes[a].tunable].name, RESOLVED(&p, tune.axes[a].tunable));
+	}
+	putchar('\n');
+}
+
+static void print_settings(const score_t *s)
+{
+	amd_params_t p;
+	size_t i;
+
+	candidate(s->index, &p);
+	printf("\n<settings>\n");
+	for (i = 0; i < TUNABLES; i++) {
+		printf("    <param name=\"%s\" value=\"%u\"/>\n", tunables[i].name, RESOLVED(&p, i));
+	}
+	printf("    <param name=\"engine\" value=\"%s\"/>\n", tune.gmm ? "gmm" : "energy");
+	printf("</settings>\n");
+}
+
+static int run_threads(int threads, void *(*fn)(void *), worker_t *workers)
+{
+	pthread_t *tids = calloc((size_t) threads, sizeof(pthread_t));
+	int i;
+
+	if (!tids) {
+		return -1;
+	}
+
+	tune.next = 0;
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&tids[i], NULL, fn, fn == precompute_worker ? (void *) &workers[i].ctx : (void *) &workers[i])) {
+			free(tids);
+			return -1;
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	free(tids);
+
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+			"usage: amd_tune [options] <file|dir>...\n"
+			"  -g name=spec   parameter to search: lo:hi:step, v1|v2|..., or a value (repeatable)\n"
+			"  -n <count>     evaluate count random grid points instead of the full grid\n"
+			"  -S <seed>      random search seed (default: 1)\n"
+			"  -k <top>       candidates to list (default: 10)\n"
+			"  -l <file>      labels, one \"path,machine|human\" per line\n"
+			"  -p <params>    fixed voice_start style overrides, e.g. engine=gmm,dual=1\n"
+			"  -j <threads>   worker threads (default: online CPUs)\n"
+			"  -r <rate>      sample rate of headerless files (default: 8000)\n"
+			"  -c <channels>  channels of headerless files (default: 1)\n"
+			"  -t <ms>        frame length (default: 20)\n");
+}
+
+int main(int argc, char **argv)
+{
+	amd_params_t defaults = AMD_TOOL_DEFAULTS;
+	const char *labels_file = NULL, *params = NULL;
+	label_t *labels = NULL;
+	size_t nlabels = 0;
+	int threads = 0, opt, i, a, nbest = 0, machines = 0;
+	uint32_t max_analysis;
+	uint64_t start;
+	double elapsed;
+	worker_t *workers;
+	score_t *best, baseline;
+	char **paths;
+	size_t n, npaths, kept = 0;
+
+	tune.seed = 1;
+	tune.top = 10;
+	tune.frame_ms = 20;
+	tune.raw_rate = 8000;
+	tune.raw_channels = 1;
+
+	while ((opt = getopt(argc, argv, "g:n:S:k:l:p:j:r:c:t:h")) != -1) {
+		switch (opt) {
+		case 'g':
+			if (parse_axis(optarg)) {
+				fprintf(stderr, "amd_tune: bad grid '%s'\n", optarg);
+				usage();
+				return 2;
+			}
+			break;
+		case 'n':
+			tune.random = strtoull(optarg, NULL, 10);
+			break;
+		case 'S':
+			tune.seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'k':
+			tune.top = atoi(optarg);
+			break;
+		case 'l':
+			labels_file = optarg;
+			break;
+		case 'p':
+			params = optarg;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'r':
+			tune.raw_rate = (uint32_t) atoi(optarg);
+			break;
+		case 'c':
+			tune.raw_channels = (uint32_t) atoi(optarg);
+			break;
+		case 't':
+			tune.frame_ms = (uint32_t) atoi(optarg);
+			break;
+		default:
+			usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	if (optind >= argc || tune.top < 1 || !tune.frame_ms) {
+		usage();
+		return 2;
+	}
+
+	tune.defaults = defaults;
+	amd_params_parse(&tune.base, params, NULL);
+	if (tune.base.engine == &amd_gmm_engine) {
+		tune.gmm = 1;
+	} else if (tune.base.engine && tune.base.engine != &amd_energy_engine) {
+		fprintf(stderr, "amd_tune: engine %s keeps per-call state that cannot be replayed from stored scores\n", tune.base.engine->name);
+		return 2;
+	}
+
+	/* Grid size, or the number of random draws */
+	tune.candidates = 1;
+	for (a = 0; a < tune.naxes; a++) {
+		tune.candidates = tune.candidates * tune.axes[a].count;
+	}
+	if (tune.random) {
+		tune.candidates = tune.random;
+	}
+
+	/* Frames past the longest total_analysis_time searched are never looked at */
+	max_analysis = tune.base.total_analysis_time ? tune.base.total_analysis_time : defaults.total_analysis_time;
+	for (a = 0; a < tune.naxes; a++) {
+		if (!strcmp(tunables[tune.axes[a].tunable].name, "total_analysis_time")) {
+			uint32_t v;
+
+			for (v = 0; v < tune.axes[a].count; v++) {
+				if (tune.axes[a].values[v] > max_analysis) {
+					max_analysis = tune.axes[a].values[v];
+				}
+			}
+		}
+	}
+	tune.max_frames = max_analysis / tune.frame_ms + 1;
+
+	if (amd_tool_collect(argv + optind, argc - optind, &paths, &npaths)) {
+		return 1;
+	}
+
+	if (labels_file && load_labels(labels_file, &labels, &nlabels)) {
+		return 1;
+	}
+
+	tune.files = calloc(npaths ? npaths : 1, sizeof(corpus_file_t));
+	for (n = 0; n < npaths; n++) {
+		int label = label_from_file(labels, nlabels, paths[n]);
+
+		if (label < 0) {
+			label = label_from_path(paths[n]);
+		}
+		if (label < 0) {
+			fprintf(stderr, "%s: no label, skipped\n", paths[n]);
+			continue;
+		}
+		tune.files[kept].path = paths[n];
+		tune.files[kept].machine = label;
+		machines += label;
+		kept++;
+	}
+	tune.count = kept;
+	if (!tune.count) {
+		fprintf(stderr, "amd_tune: no labeled recordings\n");
+		return 1;
+	}
+
+	if (threads <= 0) {
+		threads = amd_tool_cpus();
+	}
+	workers = calloc((size_t) threads, sizeof(worker_t));
+	for (i = 0; i < threads; i++) {
+		if (amd_tool_ctx_init(&workers[i].ctx) || !(workers[i].best = calloc((size_t) tune.top, sizeof(score_t)))) {
+			fprintf(stderr, "amd_tune: out of memory\n");
+			return 1;
+		}
+	}
+
+	start = amd_now_ns();
+	if (run_threads(threads, precompute_worker, workers)) {
+		return 1;
+	}
+	fprintf(stderr, "amd_tune: %zu recordings (%d machine) scored in %.3f s\n",
+			tune.count, machines, (amd_now_ns() - start) / 1e9);
+
+	start = amd_now_ns();
+	if (run_threads(threads, search_worker, workers)) {
+		return 1;
+	}
+	elapsed = (amd_now_ns() - start) / 1e9;
+	fprintf(stderr, "amd_tune: %" PRIu64 " candidates, %d threads, %.3f s (%.0f replays/s)\n",
+			tune.candidates, threads, elapsed, (double) tune.candidates * tune.count / elapsed);
+
+	/* Merge the per-thread tops */
+	best = calloc((size_t) tune.top, sizeof(score_t));
+	for (i = 0; i < threads; i++) {
+		for (a = 0; a < workers[i].nbest; a++) {
+			keep(best, &nbest, tune.top, &workers[i].best[a]);
+		}
+	}
+
+	evaluate(workers[0].ctx.hot, UINT64_MAX, &baseline);
+	print_score("baseline", &baseline);
+	for (a = 0; a < nbest; a++) {
+		char rank[16];
+
+		snprintf(rank, sizeof(rank), "#%d", a + 1);
+		print_score(rank, &best[a]);
+	}
+	if (nbest) {
+		print_settings(&best[0]);
+	}
+
+	for (i = 0; i < threads; i++) {
+		amd_tool_ctx_destroy(&workers[i].ctx);
+		free(workers[i].best);
+	}
+	for (n = 0; n < tune.count; n++) {
+		free(tune.files[n].score);
+		free(tune.files[n].write_score);
+		free(tune.files[n].voiced);
+	}
+	for (a = 0; a < tune.naxes; a++) {
+		free(tune.axes[a].values);
+	}
+	amd_tool_free_list(paths, npaths);
+	free(tune.files);
+	free(workers);
+	free(best);
+
+	return 0;
+}